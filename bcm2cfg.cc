@@ -18,8 +18,13 @@
  */
 
 #include <iostream>
+#include <fstream>
+#include <sstream>
 #include <string>
 #include <vector>
+#include <mutex>
+#include <chrono>
+#include <cstring>
 #include <getopt.h>
 #include "gwsettings.h"
 #include "nonvol2.h"
@@ -45,6 +50,7 @@ int usage(bool help = false)
 	os << "  -k <key>         Encryption key (hex string)" << endl;
 	os << "  -f <format>      Input file format (auto/gws/dyn/perm)" << endl;
 	os << "  -z               Add padding when encrypting" << endl;
+	os << "  -j <jobs>        Number of parallel jobs" << endl;
 	os << "  -q               Decrease verbosity" << endl;
 	os << "  -v               Increase verbosity" << endl;
 	os << endl;
@@ -92,6 +98,26 @@ int usage(bool help = false)
 		os << "\n    Removes a settings groups from the input file, optionally writing\n"
 				"    the resulting file to <outfile>.\n\n";
 	}
+	os << "  batch   <infile> <script> [<outfile>]" << endl;
+	if (help) {
+		os << "\n    Runs the get, set and remove commands listed in <script> (one\n"
+				"    command per line, or '-' to read from standard input), and\n"
+				"    writes the resulting file once, optionally to <outfile>.\n\n";
+	}
+	os << "  multi   info|verify|get <name> <infile> [<infile> ...]" << endl;
+	if (help) {
+		os << "\n    Runs info, verify or get on multiple input files in parallel\n"
+				"    (see -j), and prints the results as one JSON object per file,\n"
+				"    in the order of the input files.\n\n";
+	}
+	os << "  crack   <infile> dict|mask <wordlist>|<mask> [<statefile>]" << endl;
+	if (help) {
+		os << "\n    Searches for the password of an encrypted file, using either\n"
+				"    a word list, or a mask (?l = a-z, ?u = A-Z, ?d = 0-9, ?s =\n"
+				"    special characters, ?a = all of these). Candidates are tested\n"
+				"    in parallel (see -j). If <statefile> is specified, progress is\n"
+				"    saved there, and an interrupted search is resumed.\n\n";
+	}
 	os << "  dump    <infile> [<name>]" << endl;
 	if (help) {
 		os << "\n    Dump raw data of variable <name>. If omitted, dump file contents.\n\n";
@@ -123,7 +149,7 @@ int usage(bool help = false)
 }
 
 sp<settings> read_file(const string& filename, int format, const sp<profile>& profile,
-		const string& key, const string& pw)
+		const string& key, const string& pw, bool lazy = false)
 {
 	ifstream infile;
 	if (filename != "-") {
@@ -135,7 +161,7 @@ sp<settings> read_file(const string& filename, int format, const sp<profile>& pr
 
 	istream& in = filename != "-" ? infile : cin;
 
-	return settings::read(in, format, profile, key, pw);
+	return settings::read(in, format, profile, key, pw, lazy);
 }
 
 void write_file(const string& filename, const sp<settings>& settings)
@@ -247,6 +273,347 @@ int do_set_remove(int argc, char** argv, const sp<settings>& settings)
 	return 0;
 }
 
+int do_batch(int argc, char** argv, const sp<settings>& settings)
+{
+	if (argc != 3 && argc != 4) {
+		return usage(false);
+	}
+
+	ifstream infile;
+	if (argv[2] != "-"s) {
+		infile.open(argv[2]);
+		if (!infile.good()) {
+			throw user_error("failed to open "s + argv[2] + " for reading");
+		}
+	} else if (argv[1] == "-"s) {
+		throw user_error("input file and script cannot both be read from standard input");
+	}
+
+	istream& in = argv[2] != "-"s ? infile : cin;
+	bool modified = false;
+	unsigned num = 0;
+	string line;
+
+	while (getline(in, line)) {
+		++num;
+		line = trim(line);
+		if (line.empty() || line[0] == '#') {
+			continue;
+		}
+
+		// <command> <name> [<value>]; the value is the remainder of the line,
+		// and may be enclosed in double quotes
+		string cmd, name, val;
+		istringstream istr(line);
+		istr >> cmd >> name;
+		getline(istr >> ws, val);
+
+		if (val.size() >= 2 && val.front() == '"' && val.back() == '"') {
+			val = val.substr(1, val.size() - 2);
+		}
+
+		try {
+			if (cmd == "get" && !name.empty() && val.empty()) {
+				auto v = settings->get(name);
+				logger::i() << name << " = " << (logger::loglevel() < logger::info ? v->to_str() : v->to_pretty()) << endl;
+			} else if (cmd == "set" && !name.empty()) {
+				settings->set(name, val);
+				logger::i() << name << " = " << settings->get(name)->to_pretty() << endl;
+				modified = true;
+			} else if (cmd == "remove" && !name.empty() && val.empty()) {
+				settings->remove(name);
+				modified = true;
+			} else {
+				throw user_error("invalid command '" + line + "'");
+			}
+		} catch (const exception& e) {
+			throw user_error(string(argv[2]) + ":" + to_string(num) + ": " + e.what());
+		}
+	}
+
+	if (modified || argc == 4) {
+		write_file(argc == 4 ? argv[3] : argv[1], settings);
+	}
+
+	return 0;
+}
+
+// returns the length of a valid UTF-8 sequence at `i`, or 0
+size_t utf8_length(const string& str, size_t i)
+{
+	unsigned c = str[i] & 0xff;
+	size_t len;
+	unsigned min;
+
+	if (c < 0x80) {
+		return 1;
+	} else if ((c & 0xe0) == 0xc0) {
+		len = 2;
+		min = 0x80;
+	} else if ((c & 0xf0) == 0xe0) {
+		len = 3;
+		min = 0x800;
+	} else if ((c & 0xf8) == 0xf0) {
+		len = 4;
+		min = 0x10000;
+	} else {
+		return 0;
+	}
+
+	if (i + len > str.size()) {
+		return 0;
+	}
+
+	unsigned cp = c & (0x7f >> len);
+
+	for (size_t k = 1; k < len; ++k) {
+		unsigned b = str[i + k] & 0xff;
+		if ((b & 0xc0) != 0x80) {
+			return 0;
+		}
+
+		cp = (cp << 6) | (b & 0x3f);
+	}
+
+	// reject overlong encodings, surrogates and out-of-range code points
+	if (cp < min || (cp >= 0xd800 && cp <= 0xdfff) || cp > 0x10ffff) {
+		return 0;
+	}
+
+	return len;
+}
+
+string json_str(const string& str)
+{
+	string ret = "\"";
+
+	for (size_t i = 0; i < str.size(); ++i) {
+		char c = str[i];
+
+		if (c == '"' || c == '\\') {
+			ret += '\\';
+			ret += c;
+		} else if (c == '\n') {
+			ret += "\\n";
+		} else if ((c & 0xff) < 0x20) {
+			ret += "\\u00" + to_hex(c & 0xff, 2);
+		} else if ((c & 0xff) < 0x80) {
+			ret += c;
+		} else if (size_t len = utf8_length(str, i)) {
+			ret += str.substr(i, len);
+			i += len - 1;
+		} else {
+			// not valid UTF-8; treat as latin-1
+			ret += "\\u00" + to_hex(c & 0xff, 2);
+		}
+	}
+
+	return ret + "\"";
+}
+
+string json_list(const vector<string>& values)
+{
+	string ret;
+
+	for (const string& v : values) {
+		ret += (ret.empty() ? "" : ",") + v;
+	}
+
+	return "[" + ret + "]";
+}
+
+// returns the members of a json object (without braces)
+string multi_one(const string& cmd, const string& name, const string& filename, int format,
+		const sp<profile>& profile, const string& key, const string& password)
+{
+	sp<settings> settings = read_file(filename, format, profile, key, password, cmd == "get");
+	string ret;
+
+	if (cmd == "info") {
+		// "type    : gwsettings" -> "type":"gwsettings"
+		for (string line : split(settings->header_to_string(), '\n')) {
+			auto pos = line.find(':');
+			if (pos != string::npos) {
+				ret += json_str(trim(line.substr(0, pos))) + ":" + json_str(trim(line.substr(pos + 1))) + ",";
+			}
+		}
+
+		vector<string> groups;
+		for (auto p : settings->parts()) {
+			csp<nv_group> g = nv_val_cast<nv_group>(p.val);
+			groups.push_back("{\"magic\":" + json_str(g->magic().to_str())
+					+ ",\"version\":" + json_str(g->is_versioned() ? g->version().to_pretty() : "")
+					+ ",\"name\":" + json_str(p.name)
+					+ ",\"bytes\":" + to_string(g->bytes()) + "}");
+		}
+
+		ret += "\"groups\":" + json_list(groups);
+	} else if (cmd == "verify") {
+		ret += "\"valid\":"s + (settings->is_valid() ? "true" : "false");
+	} else if (!settings->is_valid()) {
+		throw user_error("invalid or encrypted file");
+	} else {
+		ret += "\"name\":" + json_str(name) + ",\"value\":" + json_str(settings->get(name)->to_str());
+	}
+
+	return ret;
+}
+
+int do_multi(int argc, char** argv, int format, const sp<profile>& profile, const string& key,
+		const string& password, unsigned jobs)
+{
+	if (argc < 3) {
+		return usage(false);
+	}
+
+	string cmd = argv[1];
+	string name;
+
+	if (cmd == "get") {
+		if (argc < 4) {
+			return usage(false);
+		}
+		name = argv[2];
+		argv += 3;
+		argc -= 3;
+	} else if (cmd == "info" || cmd == "verify") {
+		argv += 2;
+		argc -= 2;
+	} else {
+		return usage(false);
+	}
+
+	vector<string> results(argc);
+	vector<bool> done(argc);
+	size_t next = 0;
+	mutex lock;
+	int ret = 0;
+
+	parallel_for(argc, jobs, [&] (size_t i) {
+		ostringstream messages;
+		string result = "{\"file\":" + json_str(argv[i]) + ",";
+		bool ok = true;
+
+		{
+			logger::capture capture(messages);
+
+			try {
+				result += multi_one(cmd, name, argv[i], format, profile, key, password);
+			} catch (const exception& e) {
+				result += "\"error\":" + json_str(e.what());
+				ok = false;
+			}
+		}
+
+		vector<string> lines;
+		for (const string& line : split(messages.str(), '\n', false)) {
+			lines.push_back(json_str(line));
+		}
+
+		if (!lines.empty()) {
+			result += ",\"messages\":" + json_list(lines);
+		}
+
+		result += "}";
+
+		// print results in the order of the input files
+		lock_guard<mutex> guard(lock);
+		results[i] = result;
+		done[i] = true;
+
+		if (!ok) {
+			ret = 1;
+		}
+
+		for (; next < done.size() && done[next]; ++next) {
+			cout << results[next] << endl;
+			results[next].clear();
+		}
+	});
+
+	return ret;
+}
+
+int do_crack(int argc, char** argv, const sp<profile>& profile)
+{
+	if (argc != 4 && argc != 5) {
+		return usage(false);
+	}
+
+	string mode = argv[2];
+	string arg = argv[3];
+	sp<password_source> source;
+	string checksum;
+
+	if (mode == "dict") {
+		source = password_source::dictionary(arg);
+		checksum = to_hex(source->checksum());
+	} else if (mode == "mask") {
+		source = password_source::mask(arg);
+	} else {
+		return usage(false);
+	}
+
+	// the state file contains the search (mode and argument), the number
+	// of candidates and a checksum of the wordlist, and the index of the
+	// first candidate that hasn't been tested yet. if the wordlist has
+	// changed, the index is meaningless.
+	string statefile = argc == 5 ? argv[4] : "";
+	string search = mode + " " + arg;
+	string fingerprint = to_string(source->size()) + (checksum.empty() ? "" : " " + checksum);
+	uint64_t start = 0;
+
+	if (!statefile.empty()) {
+		ifstream in(statefile);
+		string line;
+
+		if (in.good() && getline(in, line)) {
+			if (line != search) {
+				throw user_error(statefile + ": state belongs to a different search ('" + line + "')");
+			} else if (!getline(in, line) || line != fingerprint) {
+				throw user_error(statefile + ": candidates have changed since the state was saved");
+			} else if (getline(in, line)) {
+				start = lexical_cast<uint64_t>(line);
+				logger::i() << "resuming at candidate " << start << " of " << source->size() << endl;
+			}
+		}
+	}
+
+	ifstream in(argv[1], ios::binary);
+	if (!in.good()) {
+		throw user_error("failed to open "s + argv[1] + " for reading");
+	}
+
+	auto last = chrono::steady_clock::now();
+
+	auto status = gws_crack(in, profile, *source, start, [&] (const crack_status& status) {
+		// the old state remains intact if writing the new one fails
+		if (!statefile.empty() && !write_file_atomic(statefile,
+				search + "\n" + fingerprint + "\n" + to_string(status.next) + "\n")) {
+			throw user_error("failed to write to " + statefile + ": " + strerror(errno));
+		}
+
+		auto now = chrono::steady_clock::now();
+		if (status.found || (now - last) >= chrono::seconds(2)) {
+			logger::v() << "tested " << status.next << "/" << source->size() << ", "
+					<< uint64_t(status.keys_per_sec) << " keys/s" << endl;
+			last = now;
+		}
+	});
+
+	logger::i() << "tested " << status.tested << " candidates at " << uint64_t(status.keys_per_sec)
+			<< " keys/s" << endl;
+
+	if (!status.found) {
+		logger::w() << "password not found" << endl;
+		return 2;
+	}
+
+	logger::i() << "found password for profile " << status.profile->name() << ":" << endl;
+	cout << source->at(status.index) << endl;
+	return 0;
+}
+
 int do_fix(int argc, char** argv, const sp<settings>& settings, bool padded)
 {
 	if (argc != 2 && argc != 3) {
@@ -297,7 +664,7 @@ int do_crypt(int argc, char** argv, const sp<settings>& settings,
 			} else if (!password.empty()) {
 				s->key(p->derive_key(password));
 			} else {
-				auto keys = p->default_keys();
+				auto& keys = p->default_keys();
 				if (keys.empty()) {
 					throw user_error("detected profile " + p->name() + " has no default keys; use '-k <key>' or '-p <password>'");
 				}
@@ -358,7 +725,7 @@ int do_main(int argc, char** argv)
 
 	opterr = 0;
 
-	while ((opt = getopt(argc, argv, "+hP:p:k:f:zvq")) != -1) {
+	while ((opt = getopt(argc, argv, "+hP:p:k:f:j:zvq")) != -1) {
 		switch (opt) {
 		case 'v':
 			loglevel = max(loglevel - 1, logger::trace);
@@ -380,6 +747,9 @@ int do_main(int argc, char** argv)
 		case 'z':
 			pad = true;
 			break;
+		case 'j':
+			default_jobs(lexical_cast<unsigned>(optarg));
+			break;
 		case 'f':
 			if (optarg == "gws"s) {
 				format = nv_group::fmt_gws;
@@ -418,8 +788,20 @@ int do_main(int argc, char** argv)
 		return usage(false);
 	}
 
+	// commands that operate on a single setting only need to decode the
+	// group it's in; all other groups are left untouched.
+	bool lazy = cmd == "set" || cmd == "remove" || cmd == "batch" || (argc == 3 &&
+			(cmd == "get" || cmd == "list" || cmd == "dump" || cmd == "type"));
+
 	sp<profile> profile = !profile_name.empty() ? profile::get(profile_name) : nullptr;
-	sp<settings> settings = read_file(argv[1], format, profile, key, password);
+
+	if (cmd == "multi") {
+		return do_multi(argc, argv, format, profile, key, password, default_jobs());
+	} else if (cmd == "crack") {
+		return do_crack(argc, argv, profile);
+	}
+
+	sp<settings> settings = read_file(argv[1], format, profile, key, password, lazy);
 
 	if (cmd == "info") {
 		return do_info(argc, argv, settings);
@@ -433,6 +815,8 @@ int do_main(int argc, char** argv)
 		return do_list_get_dump_type(argc, argv, settings);
 	} else if (cmd == "set" || cmd == "remove") {
 		return do_set_remove(argc, argv, settings);
+	} else if (cmd == "batch") {
+		return do_batch(argc, argv, settings);
 	} else if (cmd == "verify") {
 		return do_verify(argc, argv, settings);
 	} else if (cmd == "fix") {
@@ -51,6 +51,7 @@ void usage(bool help = false)
 	os << "  -F               Force operation" << endl;
 	os << "  -P <profile>     Force profile" << endl;
 	os << "  -L <filename>    I/O log file" << endl;
+	os << "  -C               Don't use the device cache" << endl;
 	os << "  -O <opt>=<val>   Override option value" << endl;
 	os << "  -q               Decrease verbosity" << endl;
 	os << "  -v               Increase verbosity" << endl;
@@ -545,7 +546,7 @@ int do_main(int argc, char** argv)
 
 	opterr = 0;
 
-	while ((opt = getopt(argc, argv, "hsARFqvP:L:O:")) != -1) {
+	while ((opt = getopt(argc, argv, "hsARFCqvP:L:O:")) != -1) {
 		switch (opt) {
 		case 's':
 			opts |= opt_safe;
@@ -575,6 +576,9 @@ int do_main(int argc, char** argv)
 		case 'L':
 			logger::set_logfile(optarg);
 			break;
+		case 'C':
+			interface::set_cache_file("");
+			break;
 		case 'h':
 		default:
 			bool help = (opt == 'h' || (optopt == '-' && argv[optind] == "help"s));
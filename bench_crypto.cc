@@ -0,0 +1,94 @@
+/**
+ * bcm2-utils
+ * Copyright (C) 2016 Joseph C. Lehner <joseph.c.lehner@gmail.com>
+ *
+ * bcm2-utils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bcm2-utils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with bcm2-utils.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <functional>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include "crypto.h"
+#include "util.h"
+using namespace std;
+using namespace bcm2utils;
+
+namespace {
+
+void bench(const string& name, string& buf, const function<void(char*, size_t)>& f)
+{
+	// warm up
+	f(&buf[0], buf.size());
+
+	unsigned runs = 0;
+	auto beg = chrono::steady_clock::now();
+	chrono::duration<double> elapsed;
+
+	do {
+		f(&buf[0], buf.size());
+		++runs;
+		elapsed = chrono::steady_clock::now() - beg;
+	} while (elapsed.count() < 1);
+
+	double mbps = (double(buf.size()) * runs / (1024 * 1024)) / elapsed.count();
+	cout << left << setw(14) << name << right << setw(10) << fixed << setprecision(1) << mbps << " MiB/s" << endl;
+}
+}
+
+int main(int argc, char** argv)
+{
+	size_t size = (argc > 1 ? bcm2dump::lexical_cast<size_t>(argv[1]) : 16) * 1024 * 1024;
+	string buf(size, '\x5a');
+
+	if (argc > 2) {
+		bcm2dump::default_jobs(bcm2dump::lexical_cast<unsigned>(argv[2]));
+	}
+
+	string key_aes256(32, 'k');
+	string key_aes128cbc(32, 'k');
+	string key_3des(24, 'k');
+	string key_des(8, 'k');
+	string key_char(1, 'k');
+
+	for (bool encrypt : { false, true }) {
+		cout << (encrypt ? "encrypt" : "decrypt") << " (" << (size / (1024 * 1024)) << " MiB, "
+				<< bcm2dump::default_jobs() << " jobs)" << endl;
+
+		bench("aes-256-ecb", buf, [&] (char* p, size_t n) {
+			crypt_aes_256_ecb(p, n, key_aes256, encrypt);
+		});
+		bench("aes-128-cbc", buf, [&] (char* p, size_t n) {
+			crypt_aes_128_cbc(p, n, key_aes128cbc, encrypt);
+		});
+		bench("3des-ecb", buf, [&] (char* p, size_t n) {
+			crypt_3des_ecb(p, n, key_3des, encrypt);
+		});
+		bench("des-ecb", buf, [&] (char* p, size_t n) {
+			crypt_des_ecb(p, n, key_des, encrypt);
+		});
+		bench("motorola", buf, [&] (char* p, size_t n) {
+			crypt_motorola(p, n, key_char);
+		});
+		bench("sub-16x16", buf, [&] (char* p, size_t n) {
+			crypt_sub_16x16(p, n, encrypt);
+		});
+		bench("xor", buf, [&] (char* p, size_t n) {
+			crypt_xor_char(p, n, key_char);
+		});
+	}
+
+	return 0;
+}
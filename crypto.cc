@@ -19,9 +19,21 @@
 
 #include <stdexcept>
 #include <cstring>
+#include <mutex>
 #include "crypto.h"
 #include "util.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// AVX2 kernels are compiled separately, and selected at runtime
+#if defined(__SSE2__) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BCM2UTILS_AVX2
+#include <immintrin.h>
+#define BCM2UTILS_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
 #if defined(__APPLE__)
 #include <CommonCrypto/CommonCrypto.h>
 #include <CommonCrypto/CommonDigest.h>
@@ -40,9 +52,11 @@
 #include <system_error>
 #define BCM2UTILS_USE_WINCRYPT
 #else
-#include <openssl/aes.h>
 #include <openssl/md5.h>
 #include <openssl/des.h>
+#include <openssl/evp.h>
+#include <openssl/err.h>
+#include <climits>
 #define BCM2UTILS_USE_OPENSSL
 #endif
 
@@ -56,13 +70,6 @@ inline const unsigned char* data(const string& buf)
 	return reinterpret_cast<const unsigned char*>(buf.data());
 }
 
-#ifndef BCM2UTILS_USE_COMMON_CRYPTO
-inline unsigned char* data(string& buf)
-{
-	return reinterpret_cast<unsigned char*>(&buf[0]);
-}
-#endif
-
 void check_keysize(const string& key, size_t size, const string& name)
 {
 	if (key.size() != size) {
@@ -85,24 +92,6 @@ inline const_DES_cblock* to_ccblock(const string& buf, size_t offset)
 {
 	return (const_DES_cblock*)&buf[offset];
 }
-
-AES_KEY make_aes_key(const string& key, bool encrypt)
-{
-	AES_KEY ret;
-	int err;
-
-	if (!encrypt) {
-		err = AES_set_decrypt_key(data(key), key.size() * 8, &ret);
-	} else {
-		err = AES_set_encrypt_key(data(key), key.size() * 8, &ret);
-	}
-
-	if (err) {
-		throw runtime_error("failed to set AES key: error " + to_string(err));
-	}
-
-	return ret;
-}
 #endif
 
 #if defined(BCM2UTILS_USE_WINCRYPT) || defined(BCM2UTILS_USE_COMMON_CRYPTO)
@@ -179,13 +168,23 @@ class wincrypt_hash
 {
 	public:
 	wincrypt_hash(ALG_ID algo)
-	: m_hash(0)
+	: m_ctx(make_shared<wincrypt_context>()), m_hash(0)
 	{
-		if (!CryptCreateHash(m_ctx.handle, algo, 0, 0, &m_hash)) {
+		if (!CryptCreateHash(m_ctx->handle, algo, 0, 0, &m_hash)) {
 			throw winapi_error("CryptCreateHash");
 		}
 	}
 
+	wincrypt_hash(const wincrypt_hash& other)
+	: m_ctx(other.m_ctx), m_hash(0)
+	{
+		if (!CryptDuplicateHash(other.m_hash, nullptr, 0, &m_hash)) {
+			throw winapi_error("CryptDuplicateHash");
+		}
+	}
+
+	wincrypt_hash& operator=(const wincrypt_hash& other) = delete;
+
 	~wincrypt_hash()
 	{
 		if (m_hash) {
@@ -197,7 +196,8 @@ class wincrypt_hash
 	{ return m_hash; }
 
 	private:
-	wincrypt_context m_ctx;
+	// a duplicated hash must not outlive the original's provider
+	shared_ptr<wincrypt_context> m_ctx;
 	HCRYPTHASH m_hash;
 };
 
@@ -271,13 +271,14 @@ class wincrypt_key
 
 #if defined(BCM2UTILS_USE_COMMON_CRYPTO)
 
-string crypt_generic(const enctype& et, const string& ibuf, const string& key, bool encrypt)
+void crypt_generic(const enctype& et, char* buf, size_t size, const string& key, bool encrypt)
 {
 	check_keysize(key, et);
 
 	size_t moved;
-	size_t len = align_left(ibuf.size(), et.blocksize);
-	string obuf(len, '\0');
+	size_t len = align_left(size, et.blocksize);
+
+	// trailing data that is not a multiple of the block size is left untouched
 
 	CCCryptorStatus ret = CCCrypt(
 			encrypt ? kCCEncrypt : kCCDecrypt,
@@ -285,8 +286,8 @@ string crypt_generic(const enctype& et, const string& ibuf, const string& key, b
 			et.ecb ? kCCOptionECBMode : 0,
 			key.data(), et.keysize,
 			et.ecb ? nullptr : key.data() + et.keysize,
-			ibuf.data(), len,
-			&obuf[0], len,
+			buf, len,
+			buf, len,
 			&moved);
 
 	if (ret != kCCSuccess) {
@@ -294,166 +295,318 @@ string crypt_generic(const enctype& et, const string& ibuf, const string& key, b
 	} else if (moved != len) {
 		throw runtime_error("CCCrypt: expected length " + to_string(len) + ", got " + to_string(moved));
 	}
-
-	if (len < ibuf.size()) {
-		obuf += ibuf.substr(len);
-	}
-
-	return obuf;
 }
 #elif defined(BCM2UTILS_USE_WINCRYPT)
-string crypt_generic(const enctype& et, const string& ibuf, const string& key, bool encrypt)
+void crypt_generic(const enctype& et, char* buf, size_t size, const string& key, bool encrypt)
 {
 	wincrypt_key ckey(et, key);
 
-	DWORD len = align_left(ibuf.size(), et.blocksize);
-	string obuf = ibuf;
+	DWORD len = align_left(size, et.blocksize);
 
 	// since we want to avoid wincrypt's padding, pass FALSE to both
 	// crypt functions, even though it's technically the final (and only) chunk
 
 	BOOL ok;
 	if (encrypt) {
-		ok = CryptEncrypt(ckey.get(), 0, FALSE, 0, reinterpret_cast<unsigned char*>(&obuf[0]), &len, len);
+		ok = CryptEncrypt(ckey.get(), 0, FALSE, 0, reinterpret_cast<unsigned char*>(buf), &len, len);
 	} else {
-		ok = CryptDecrypt(ckey.get(), 0, FALSE, 0, reinterpret_cast<unsigned char*>(&obuf[0]), &len);
+		ok = CryptDecrypt(ckey.get(), 0, FALSE, 0, reinterpret_cast<unsigned char*>(buf), &len);
 	}
 
 	if (!ok) {
 		throw winapi_error(encrypt ? "CryptEncrypt" : "CryptDecrypt");
 	}
-
-	// no need to deal with the remaining data, since we copied ibuf to obuf
-	return obuf;
 }
 #elif defined(BCM2UTILS_USE_OPENSSL)
-template<size_t BlockSize, class F> string crypt_generic_ecb(const string& ibuf, const F& crypter)
+// EVP picks the fastest implementation available (AES-NI, etc.), and processes
+// the whole buffer at once. returns false if the cipher is not available (single
+// DES requires the legacy provider in OpenSSL 3).
+bool crypt_evp(const EVP_CIPHER* cipher, char* buf, size_t size, const string& key,
+		const unsigned char* iv, bool encrypt)
 {
-	string obuf = ibuf;
+	unique_ptr<EVP_CIPHER_CTX, decltype(&EVP_CIPHER_CTX_free)> ctx(
+			EVP_CIPHER_CTX_new(), &EVP_CIPHER_CTX_free);
 
-	for (size_t i = 0; (i + BlockSize - 1) < ibuf.size(); i += BlockSize) {
-		crypter(data(ibuf) + i, reinterpret_cast<uint8_t*>(&obuf[i]));
+	if (!ctx) {
+		throw runtime_error("EVP_CIPHER_CTX_new failed");
 	}
 
-	return obuf;
+	if (!cipher || !EVP_CipherInit_ex(ctx.get(), cipher, nullptr, data(key), iv, encrypt)) {
+		ERR_clear_error();
+		return false;
+	}
+
+	EVP_CIPHER_CTX_set_padding(ctx.get(), 0);
+
+	size_t blocksize = EVP_CIPHER_block_size(cipher);
+	size_t len = align_left(size, blocksize);
+	unsigned char* p = reinterpret_cast<unsigned char*>(buf);
+
+	while (len) {
+		// EVP_CipherUpdate takes an int
+		int n = min(len, align_left<size_t>(INT_MAX, blocksize));
+		int moved;
+
+		if (!EVP_CipherUpdate(ctx.get(), p, &moved, p, n) || moved != n) {
+			throw runtime_error("EVP_CipherUpdate failed");
+		}
+
+		p += n;
+		len -= n;
+	}
+
+	return true;
+}
+
+void crypt_evp_checked(const EVP_CIPHER* cipher, const string& name, char* buf, size_t size,
+		const string& key, const unsigned char* iv, bool encrypt)
+{
+	if (!crypt_evp(cipher, buf, size, key, iv, encrypt)) {
+		throw runtime_error("cipher " + name + " is not available");
+	}
+}
+
+template<size_t BlockSize, class F> void crypt_generic_ecb(char* buf, size_t size, const F& crypter)
+{
+	uint8_t* p = reinterpret_cast<uint8_t*>(buf);
+
+	for (size_t i = 0; (i + BlockSize - 1) < size; i += BlockSize) {
+		crypter(p + i, p + i);
+	}
 }
 #endif
+
+// buffers smaller than this are processed on the calling thread
+const size_t c_parallel_min = 1024 * 1024;
+const size_t c_parallel_chunk = 256 * 1024;
+
+// returns the chunk size for processing the buffer in parallel, or 0 if
+// it's not worth it.
+size_t parallel_chunk_size(size_t size, size_t blocksize)
+{
+	if (align_left(size, blocksize) < c_parallel_min || default_jobs() < 2) {
+		return 0;
+	}
+
+	return align_left(c_parallel_chunk, blocksize);
 }
 
-string hash_md5(const string& buf)
+// calls crypter(chunk, size, index) for consecutive chunks of the buffer, in
+// parallel. the last chunk also contains the remaining data, if any. `chunk`
+// is the chunk size, as returned by parallel_chunk_size().
+template<class F> void crypt_chunked(char* buf, size_t size, size_t chunk, const F& crypter)
 {
-	string md5(16, '\0');
+	if (!chunk) {
+		crypter(buf, size, 0);
+		return;
+	}
+
+	size_t count = size / chunk;
+
+	parallel_for(count, default_jobs(), [&] (size_t i) {
+		size_t offset = i * chunk;
+		crypter(buf + offset, (i + 1) < count ? chunk : size - offset, i);
+	});
+}
+
+// wraps an in-place crypto function for use with the string-based API
+template<class... Params, class... Args> string crypt_copy(void (*crypter)(char*, size_t, Params...),
+		string buf, const Args&... args)
+{
+	if (!buf.empty()) {
+		crypter(&buf[0], buf.size(), args...);
+	}
+
+	return buf;
+}
+}
+
 #ifndef BCM2UTILS_USE_WINCRYPT
+struct md5::state
+{
 	MD5_CTX ctx;
+};
 
-	MD5_Init(&ctx);
-	MD5_Update(&ctx, data(buf), buf.size());
-	MD5_Final(reinterpret_cast<unsigned char*>(&md5[0]), &ctx);
-
-	return md5;
+md5::md5()
+: m_state(new state)
+{
+	MD5_Init(&m_state->ctx);
+}
 #else
-	wincrypt_hash hash(CALG_MD5);
+struct md5::state
+{
+	state() : hash(CALG_MD5) {}
 
-	if (!CryptHashData(hash.get(), data(buf), buf.size(), 0)) {
+	wincrypt_hash hash;
+};
+
+md5::md5()
+: m_state(new state)
+{}
+#endif
+
+md5::md5(const md5& other)
+: m_state(new state(*other.m_state))
+{}
+
+md5& md5::operator=(const md5& other)
+{
+	if (this != &other) {
+		m_state.reset(new state(*other.m_state));
+	}
+
+	return *this;
+}
+
+md5::~md5()
+{}
+
+md5& md5::update(const void* buf, size_t len)
+{
+#ifndef BCM2UTILS_USE_WINCRYPT
+	MD5_Update(&m_state->ctx, buf, len);
+#else
+	if (!CryptHashData(m_state->hash.get(), reinterpret_cast<const BYTE*>(buf), len, 0)) {
 		throw winapi_error("CryptHashData");
 	}
+#endif
+	return *this;
+}
 
-	DWORD size = md5.size();
-	if (!CryptGetHashParam(hash.get(), HP_HASHVAL, reinterpret_cast<unsigned char*>(&md5[0]), &size, 0)) {
+string md5::final()
+{
+	string digest(16, '\0');
+#ifndef BCM2UTILS_USE_WINCRYPT
+	MD5_Final(reinterpret_cast<unsigned char*>(&digest[0]), &m_state->ctx);
+#else
+	DWORD size = digest.size();
+	if (!CryptGetHashParam(m_state->hash.get(), HP_HASHVAL, reinterpret_cast<unsigned char*>(&digest[0]), &size, 0)) {
 		throw winapi_error("CryptGetHashParam");
 	}
-
-	return md5;
 #endif
+	return digest;
+}
+
+string hash_md5(const string& buf)
+{
+	return md5().update(buf).final();
 }
 
-string crypt_3des_ecb(const string& ibuf, const string& key, bool encrypt)
+void crypt_3des_ecb(char* buf, size_t size, const string& key, bool encrypt)
 {
 #if defined(BCM2UTILS_USE_OPENSSL)
 	check_keysize(key, 24, "3des-ecb");
-	DES_key_schedule ks[3];
-
-	for (int i = 0; i < 3; ++i) {
-		DES_set_key_unchecked(to_ccblock(key, i * 8), &ks[i]);
-	}
+#endif
 
-	return crypt_generic_ecb<8>(ibuf, [&ks, &encrypt](const uint8_t *iblock, uint8_t *oblock) {
-			DES_ecb3_encrypt(to_ccblock(iblock), to_cblock(oblock), &ks[0], &ks[1], &ks[2],
-					encrypt ? DES_ENCRYPT : DES_DECRYPT);
-	});
+	crypt_chunked(buf, size, parallel_chunk_size(size, 8), [&] (char* chunk, size_t len, size_t) {
+#if defined(BCM2UTILS_USE_OPENSSL)
+		crypt_evp_checked(EVP_des_ede3_ecb(), "3des-ecb", chunk, len, key, nullptr, encrypt);
 #else
-	return crypt_generic(et_3des_ecb, ibuf, key, encrypt);
+		crypt_generic(et_3des_ecb, chunk, len, key, encrypt);
 #endif
+	});
+}
+
+string crypt_3des_ecb(const string& buf, const string& key, bool encrypt)
+{
+	return crypt_copy(&crypt_3des_ecb, buf, key, encrypt);
 }
 
-string crypt_des_ecb(const string& ibuf, const string& key, bool encrypt)
+void crypt_des_ecb(char* buf, size_t size, const string& key, bool encrypt)
 {
 #if defined(BCM2UTILS_USE_OPENSSL)
 	check_keysize(key, 8, "des-ecb");
-	DES_key_schedule ks;
-	DES_set_key_unchecked(to_ccblock(key, 0), &ks);
+#endif
 
-	return crypt_generic_ecb<8>(ibuf, [&ks, &encrypt](const uint8_t *iblock, uint8_t *oblock) {
-			DES_ecb_encrypt(to_ccblock(iblock), to_cblock(oblock), &ks,
-					encrypt ? DES_ENCRYPT : DES_DECRYPT);
-	});
+	crypt_chunked(buf, size, parallel_chunk_size(size, 8), [&] (char* chunk, size_t len, size_t) {
+#if defined(BCM2UTILS_USE_OPENSSL)
+		if (crypt_evp(EVP_des_ecb(), chunk, len, key, nullptr, encrypt)) {
+			return;
+		}
+
+		DES_key_schedule ks;
+		DES_set_key_unchecked(to_ccblock(key, 0), &ks);
+
+		crypt_generic_ecb<8>(chunk, len, [&ks, &encrypt](const uint8_t *iblock, uint8_t *oblock) {
+				DES_ecb_encrypt(to_ccblock(iblock), to_cblock(oblock), &ks,
+						encrypt ? DES_ENCRYPT : DES_DECRYPT);
+		});
 #else
-	return crypt_generic(et_des_ecb, ibuf, key, encrypt);
+		crypt_generic(et_des_ecb, chunk, len, key, encrypt);
 #endif
+	});
+}
+
+string crypt_des_ecb(const string& buf, const string& key, bool encrypt)
+{
+	return crypt_copy(&crypt_des_ecb, buf, key, encrypt);
 }
 
-string crypt_aes_256_ecb(const string& ibuf, const string& key, bool encrypt)
+void crypt_aes_256_ecb(char* buf, size_t size, const string& key, bool encrypt)
 {
 #if defined(BCM2UTILS_USE_OPENSSL)
 	check_keysize(key, 32, "aes-256-ecb");
-	AES_KEY aes = make_aes_key(key, encrypt);
+#endif
 
-	return crypt_generic_ecb<16>(ibuf, [&aes, &encrypt](const uint8_t *iblock, uint8_t *oblock) {
-			if (encrypt) {
-				AES_encrypt(iblock, oblock, &aes);
-			} else {
-				AES_decrypt(iblock, oblock, &aes);
-			}
-	});
+	crypt_chunked(buf, size, parallel_chunk_size(size, 16), [&] (char* chunk, size_t len, size_t) {
+#if defined(BCM2UTILS_USE_OPENSSL)
+		crypt_evp_checked(EVP_aes_256_ecb(), "aes-256-ecb", chunk, len, key, nullptr, encrypt);
 #else
-	return crypt_generic(et_aes_256_ecb, ibuf, key, encrypt);
+		crypt_generic(et_aes_256_ecb, chunk, len, key, encrypt);
 #endif
+	});
 }
 
-#ifdef BCM2UTILS_USE_OPENSSL
-namespace {
-template<size_t BITS> string crypt_aes_cbc(const string& ibuf, const string& key_and_iv, bool encrypt)
+string crypt_aes_256_ecb(const string& buf, const string& key, bool encrypt)
 {
-	// first the key, then the iv
-	check_keysize(key_and_iv, (BITS / 8) + 16, "aes-" + to_string(BITS) + "-cbc");
-
-	string key = key_and_iv.substr(0, BITS / 8);
-	string iv = key_and_iv.substr(BITS / 8);
+	return crypt_copy(&crypt_aes_256_ecb, buf, key, encrypt);
+}
 
-	AES_KEY aes = make_aes_key(key, encrypt);
-	string obuf = ibuf;
-	AES_cbc_encrypt(data(ibuf), data(obuf), ibuf.size(), &aes, data(iv), encrypt);
-	return obuf;
+namespace {
+void crypt_aes_128_cbc_serial(char* buf, size_t size, const string& key_and_iv, bool encrypt)
+{
+#if defined(BCM2UTILS_USE_OPENSSL)
+	crypt_evp_checked(EVP_aes_128_cbc(), "aes-128-cbc", buf, size, key_and_iv,
+			data(key_and_iv) + 16, encrypt);
+#else
+	crypt_generic(et_aes_128_cbc, buf, size, key_and_iv, encrypt);
+#endif
 }
 }
 
-string crypt_aes_128_cbc(const string& ibuf, const string& key_and_iv, bool encrypt)
+void crypt_aes_128_cbc(char* buf, size_t size, const string& key_and_iv, bool encrypt)
 {
-	return crypt_aes_cbc<128>(ibuf, key_and_iv, encrypt);
+	// first the key, then the iv
+	check_keysize(key_and_iv, 16 + 16, "aes-128-cbc");
+
+	if (encrypt) {
+		crypt_aes_128_cbc_serial(buf, size, key_and_iv, true);
+		return;
+	}
+
+	// when decrypting, the iv of each chunk is the last ciphertext block of the
+	// previous one. since decryption is done in-place, these must be saved first.
+	size_t chunk = parallel_chunk_size(size, 16);
+	vector<string> keys(1, key_and_iv);
+
+	for (size_t offset = chunk; chunk && (offset + chunk) <= size; offset += chunk) {
+		keys.push_back(key_and_iv.substr(0, 16) + string(buf + offset - 16, 16));
+	}
+
+	crypt_chunked(buf, size, chunk, [&] (char* p, size_t len, size_t i) {
+		crypt_aes_128_cbc_serial(p, len, keys[i], false);
+	});
 }
-#else
-string crypt_aes_128_cbc(const string& ibuf, const string& key_and_iv, bool encrypt)
+
+string crypt_aes_128_cbc(const string& buf, const string& key_and_iv, bool encrypt)
 {
-	return crypt_generic(et_aes_128_cbc, ibuf, key_and_iv, encrypt);
+	return crypt_copy(&crypt_aes_128_cbc, buf, key_and_iv, encrypt);
 }
-#endif
 
 namespace {
-uint32_t srand_motorola;
-
-int32_t rand_motorola()
+int32_t rand_motorola(uint32_t& seed)
 {
-	uint32_t result, next = srand_motorola;
+	uint32_t result, next = seed;
 
 	next *= 0x41c64e6d;
 	next += 0x3039;
@@ -467,55 +620,236 @@ int32_t rand_motorola()
 	next += 0x3039;
 	result = (result + (next >> 25)) & 0x7fffffff;
 
-	srand_motorola = next;
+	seed = next;
 	return result;
 }
 }
 
+namespace {
+#ifdef BCM2UTILS_AVX2
+bool have_avx2()
+{
+	static const bool ret = [] () {
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2") != 0;
+	}();
+
+	return ret;
+}
+
+BCM2UTILS_TARGET_AVX2 size_t xor_bytes_avx2(char* buf, const char* key, size_t size)
+{
+	size_t i = 0;
+
+	for (; (i + 32) <= size; i += 32) {
+		__m256i* p = reinterpret_cast<__m256i*>(buf + i);
+		__m256i k = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(key + i));
+		_mm256_storeu_si256(p, _mm256_xor_si256(_mm256_loadu_si256(p), k));
+	}
+
+	return i;
+}
+#endif
+
+// buf[i] ^= key[i], for all i < size
+void xor_bytes(char* buf, const char* key, size_t size)
+{
+	size_t i = 0;
+
+#ifdef BCM2UTILS_AVX2
+	if (have_avx2()) {
+		i = xor_bytes_avx2(buf, key, size);
+	}
+#endif
+#if defined(__SSE2__)
+	for (; (i + 16) <= size; i += 16) {
+		__m128i* p = reinterpret_cast<__m128i*>(buf + i);
+		__m128i k = _mm_loadu_si128(reinterpret_cast<const __m128i*>(key + i));
+		_mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p), k));
+	}
+#endif
+
+	for (; i < size; ++i) {
+		buf[i] ^= key[i];
+	}
+}
+
+uint8_t motorola_next(uint32_t& seed)
+{
+	double r = rand_motorola(seed);
+	return int(((r / 0x7fffffff) * 255) + 1);
+}
+
+// keystreams are cached up to this length, which covers the probes made
+// while detecting a file's profile (see gwsettings.cc). longer buffers
+// continue from the generator state after the cached prefix.
+const size_t c_motorola_prefix = 256;
+
+struct motorola_keystream
+{
+	char bytes[c_motorola_prefix];
+	// generator state after the last byte
+	uint32_t seed;
+};
+
+// since the key is a single byte, there are only 256 keystreams (64 KiB in
+// total), which are all generated on first use.
+const motorola_keystream& get_motorola_keystream(uint8_t key)
+{
+	static const vector<motorola_keystream> cache = [] () {
+		vector<motorola_keystream> ret(256);
+
+		for (unsigned k = 0; k < ret.size(); ++k) {
+			auto& ks = ret[k];
+			ks.seed = k;
+
+			for (char& c : ks.bytes) {
+				c = motorola_next(ks.seed);
+			}
+		}
+
+		return ret;
+	}();
+
+	return cache[key];
+}
+}
+
 // this is some snakeoily shit right here!
-string crypt_motorola(string buf, const string& key)
+void crypt_motorola(char* buf, size_t size, const string& key)
 {
 	check_keysize(key, 1, "motorola");
 
-	srand_motorola = key[0] & 0xff;
+	auto& ks = get_motorola_keystream(key[0] & 0xff);
+	size_t n = min(size, c_motorola_prefix);
+	xor_bytes(buf, ks.bytes, n);
 
-	for (size_t i = 0; i < buf.size(); ++i) {
-		double r = rand_motorola();
-		int x = ((r / 0x7fffffff) * 255) + 1;
-		buf[i] ^= x;
+	uint32_t seed = ks.seed;
+	for (size_t i = n; i < size; ++i) {
+		buf[i] ^= motorola_next(seed);
 	}
+}
 
-	return buf;
+string crypt_motorola(string buf, const string& key)
+{
+	return crypt_copy(&crypt_motorola, move(buf), key);
 }
 
-// ditto!
-string crypt_sub_16x16(string buf, bool encrypt)
+namespace {
+#ifdef BCM2UTILS_AVX2
+// these return the number of bytes processed
+
+BCM2UTILS_TARGET_AVX2 size_t sub_16x16_avx2(char* buf, size_t aligned, bool encrypt)
+{
+	const __m256i base32 = _mm256_setr_epi8(
+			0, 0, 2, 0, 4, 0, 6, 0, 8, 0, 10, 0, 12, 0, 14, 0,
+			16, 0, 18, 0, 20, 0, 22, 0, 24, 0, 26, 0, 28, 0, 30, 0);
+
+	size_t i = 0;
+
+	for (; (i + 32) <= aligned; i += 32) {
+		__m256i* p = reinterpret_cast<__m256i*>(buf + i);
+		__m256i k = _mm256_add_epi8(base32, _mm256_set1_epi16(i & 0xff));
+		__m256i v = _mm256_loadu_si256(p);
+		v = encrypt ? _mm256_add_epi8(v, k) : _mm256_sub_epi8(v, k);
+		v = _mm256_or_si256(_mm256_slli_epi16(v, 8), _mm256_srli_epi16(v, 8));
+		_mm256_storeu_si256(p, v);
+	}
+
+	return i;
+}
+
+BCM2UTILS_TARGET_AVX2 size_t xor_char_avx2(char* buf, size_t size, char key)
 {
-	for (size_t i = 0; i < (buf.size() / 16) * 16; i += 2) {
-		unsigned k = i & 0xff;
+	const __m256i k32 = _mm256_set1_epi8(key);
+	size_t i = 0;
+
+	for (; (i + 32) <= size; i += 32) {
+		__m256i* p = reinterpret_cast<__m256i*>(buf + i);
+		_mm256_storeu_si256(p, _mm256_xor_si256(_mm256_loadu_si256(p), k32));
+	}
+
+	return i;
+}
+#endif
 
-		if (encrypt) {
-			buf[i] = (buf[i] + k) & 0xff;
-		} else {
-			buf[i] = (buf[i] - k) & 0xff;
+// swaps each pair of bytes, after adding (or subtracting) the offset to
+// the first byte of each pair, if within the first `aligned` bytes.
+inline void sub_16x16_scalar(char* buf, size_t i, size_t aligned, size_t size, bool encrypt)
+{
+	for (; (i + 1) < size; i += 2) {
+		char c = buf[i];
+
+		if (i < aligned) {
+			unsigned k = i & 0xff;
+			c = encrypt ? (c + k) : (c - k);
 		}
+
+		buf[i] = buf[i + 1];
+		buf[i + 1] = c;
 	}
+}
+}
+
+// ditto!
+void crypt_sub_16x16(char* buf, size_t size, bool encrypt)
+{
+	size_t aligned = (size / 16) * 16;
+	size_t i = 0;
 
-	for (size_t i = 0; (i + 1) < buf.size(); i += 2) {
-		swap(buf[i], buf[i + 1]);
+#ifdef BCM2UTILS_AVX2
+	if (have_avx2()) {
+		i = sub_16x16_avx2(buf, aligned, encrypt);
+	}
+#endif
+#if defined(__SSE2__)
+	const __m128i base16 = _mm_setr_epi8(0, 0, 2, 0, 4, 0, 6, 0, 8, 0, 10, 0, 12, 0, 14, 0);
+
+	for (; (i + 16) <= aligned; i += 16) {
+		__m128i* p = reinterpret_cast<__m128i*>(buf + i);
+		__m128i k = _mm_add_epi8(base16, _mm_set1_epi16(i & 0xff));
+		__m128i v = _mm_loadu_si128(p);
+		v = encrypt ? _mm_add_epi8(v, k) : _mm_sub_epi8(v, k);
+		v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+		_mm_storeu_si128(p, v);
 	}
+#endif
 
-	return buf;
+	sub_16x16_scalar(buf, i, aligned, size, encrypt);
 }
 
-string crypt_xor_char(string buf, const string& key)
+string crypt_sub_16x16(string buf, bool encrypt)
+{
+	return crypt_copy(&crypt_sub_16x16, move(buf), encrypt);
+}
+
+void crypt_xor_char(char* buf, size_t size, const string& key)
 {
 	check_keysize(key, 1, "xor");
 
-	for (size_t i = 0; i < buf.size(); ++i) {
-		buf[i] ^= (key[0] & 0xff);
+	size_t i = 0;
+
+#ifdef BCM2UTILS_AVX2
+	if (have_avx2()) {
+		i = xor_char_avx2(buf, size, key[0]);
 	}
+#endif
+#if defined(__SSE2__)
+	const __m128i k16 = _mm_set1_epi8(key[0]);
 
-	return buf;
+	for (; (i + 16) <= size; i += 16) {
+		__m128i* p = reinterpret_cast<__m128i*>(buf + i);
+		_mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p), k16));
+	}
+#endif
+
+	for (; i < size; ++i) {
+		buf[i] ^= key[0];
+	}
+}
+
+string crypt_xor_char(string buf, const string& key)
+{
+	return crypt_copy(&crypt_xor_char, move(buf), key);
 }
 }
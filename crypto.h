@@ -19,11 +19,47 @@
 
 #ifndef BCM2UTILS_CRYPTO_H
 #define BCM2UTILS_CRYPTO_H
+#include <memory>
 #include <string>
 namespace bcm2utils {
 
+// incremental md5. copying an instance clones the current hash state,
+// so a common prefix can be hashed once and then completed with
+// different suffixes.
+class md5
+{
+	public:
+	md5();
+	md5(const md5& other);
+	md5& operator=(const md5& other);
+	~md5();
+
+	md5& update(const void* buf, size_t len);
+	md5& update(const std::string& buf)
+	{ return update(buf.data(), buf.size()); }
+
+	// returns the digest; the instance must not be used afterwards
+	std::string final();
+
+	private:
+	struct state;
+	std::unique_ptr<state> m_state;
+};
+
 std::string hash_md5(const std::string& buf);
 
+// in-place variants. with block ciphers, trailing data that is not a multiple
+// of the block size is left as-is.
+
+void crypt_aes_256_ecb(char* buf, size_t size, const std::string& key, bool encrypt);
+void crypt_aes_128_cbc(char* buf, size_t size, const std::string& key, bool encrypt);
+void crypt_3des_ecb(char* buf, size_t size, const std::string& key, bool encrypt);
+void crypt_des_ecb(char* buf, size_t size, const std::string& key, bool encrypt);
+
+void crypt_motorola(char* buf, size_t size, const std::string& key);
+void crypt_sub_16x16(char* buf, size_t size, bool encrypt);
+void crypt_xor_char(char* buf, size_t size, const std::string& key);
+
 std::string crypt_aes_256_ecb(const std::string& buf, const std::string& key, bool encrypt);
 std::string crypt_aes_128_cbc(const std::string& buf, const std::string& key, bool encrypt);
 std::string crypt_3des_ecb(const std::string& buf, const std::string& key, bool encrypt);
@@ -0,0 +1,694 @@
+/**
+ * bcm2-utils
+ * Copyright (C) 2016-2018 Joseph Lehner <joseph.c.lehner@gmail.com>
+ *
+ * bcm2-utils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bcm2-utils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with bcm2-utils.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+#include "decompress.h"
+#include "util.h"
+#include "ps.h"
+
+using namespace std;
+
+namespace bcm2dump {
+namespace {
+
+const size_t io_chunk_size = 64 * 1024;
+
+class byte_reader
+{
+	public:
+	byte_reader(istream& in, uint64_t length)
+	: m_in(in), m_remaining(length), m_buf(io_chunk_size)
+	{}
+
+	// number of compressed bytes that have not been consumed yet
+	uint64_t remaining() const
+	{ return m_remaining + (m_end - m_pos); }
+
+	uint8_t get()
+	{
+		if (m_pos == m_end) {
+			fill();
+		}
+
+		return m_buf[m_pos++];
+	}
+
+	// puts back the last `n` bytes. only valid as long as
+	// these are still in the buffer.
+	void unget(size_t n)
+	{
+		if (n > m_pos) {
+			throw logic_error("cannot unget " + to_string(n) + " bytes");
+		}
+
+		m_pos -= n;
+	}
+
+	private:
+	void fill()
+	{
+		if (!m_remaining) {
+			throw runtime_error("unexpected end of compressed data");
+		}
+
+		size_t n = min<uint64_t>(m_remaining, m_buf.size());
+		if (!m_in.read(reinterpret_cast<char*>(m_buf.data()), n)) {
+			throw runtime_error("read error (data)");
+		}
+
+		m_remaining -= n;
+		m_pos = 0;
+		m_end = n;
+	}
+
+	istream& m_in;
+	uint64_t m_remaining;
+	vector<uint8_t> m_buf;
+	size_t m_pos = 0;
+	size_t m_end = 0;
+};
+
+// circular buffer, holding the last `size` bytes of decompressed data.
+// data is written to the output stream whenever the buffer wraps.
+class out_window
+{
+	public:
+	out_window(ostream& out, uint32_t size)
+	: m_out(out), m_buf(size)
+	{}
+
+	uint64_t total() const
+	{ return m_total; }
+
+	bool empty() const
+	{ return !m_total; }
+
+	bool has_distance(uint32_t dist) const
+	{ return dist && dist <= min<uint64_t>(m_total, m_buf.size()); }
+
+	void put(uint8_t b)
+	{
+		m_buf[m_pos++] = b;
+		++m_total;
+
+		if (m_pos == m_buf.size()) {
+			flush();
+			m_pos = 0;
+		}
+	}
+
+	// returns the byte `dist` bytes back from the current position (1 = last byte)
+	uint8_t get(uint32_t dist) const
+	{ return m_buf[dist <= m_pos ? m_pos - dist : m_buf.size() - dist + m_pos]; }
+
+	void copy(uint32_t dist, uint32_t len)
+	{
+		if (!has_distance(dist)) {
+			throw runtime_error("invalid match distance " + to_string(dist));
+		}
+
+		while (len--) {
+			put(get(dist));
+		}
+	}
+
+	void flush()
+	{
+		if (m_pos > m_flushed) {
+			if (!m_out.write(reinterpret_cast<const char*>(m_buf.data() + m_flushed), m_pos - m_flushed)) {
+				throw runtime_error("write error");
+			}
+		}
+
+		m_flushed = m_pos == m_buf.size() ? 0 : m_pos;
+	}
+
+	private:
+	ostream& m_out;
+	vector<uint8_t> m_buf;
+	size_t m_pos = 0;
+	size_t m_flushed = 0;
+	uint64_t m_total = 0;
+};
+
+// LZMA, as used by the 7-zip based tools in Broadcom's SDK. The compressed
+// data starts with the 5-byte properties header, which may be followed by
+// the 64-bit uncompressed size (as in .lzma files).
+class lzma_decompressor : public decompressor
+{
+	typedef uint16_t prob;
+
+	static constexpr unsigned c_prob_bits = 11;
+	static constexpr prob c_prob_init = (1 << c_prob_bits) / 2;
+	static constexpr unsigned c_move_bits = 5;
+	static constexpr unsigned c_states = 12;
+	static constexpr unsigned c_pos_bits_max = 4;
+	static constexpr unsigned c_len_to_pos_states = 4;
+	static constexpr unsigned c_align_bits = 4;
+	static constexpr unsigned c_end_pos_model_index = 14;
+	static constexpr unsigned c_full_distances = 1 << (c_end_pos_model_index >> 1);
+	static constexpr unsigned c_match_min_len = 2;
+	static constexpr uint32_t c_max_dict_size = 1 << 28;
+
+	class range_decoder
+	{
+		public:
+		range_decoder(byte_reader& in) : m_in(in)
+		{
+			if (m_in.get() != 0) {
+				throw runtime_error("lzma: invalid range coder data");
+			}
+
+			for (int i = 0; i < 4; ++i) {
+				m_code = (m_code << 8) | m_in.get();
+			}
+
+			if (m_code == m_range) {
+				throw runtime_error("lzma: invalid range coder data");
+			}
+		}
+
+		bool finished_ok() const
+		{ return m_code == 0; }
+
+		unsigned bit(prob* p)
+		{
+			unsigned v = *p;
+			uint32_t bound = (m_range >> c_prob_bits) * v;
+			unsigned symbol;
+
+			if (m_code < bound) {
+				v += ((1 << c_prob_bits) - v) >> c_move_bits;
+				m_range = bound;
+				symbol = 0;
+			} else {
+				v -= v >> c_move_bits;
+				m_code -= bound;
+				m_range -= bound;
+				symbol = 1;
+			}
+
+			*p = v;
+			normalize();
+			return symbol;
+		}
+
+		uint32_t direct_bits(unsigned n)
+		{
+			uint32_t ret = 0;
+
+			while (n--) {
+				m_range >>= 1;
+				m_code -= m_range;
+				uint32_t t = 0 - (m_code >> 31);
+				m_code += m_range & t;
+
+				if (m_code == m_range) {
+					throw runtime_error("lzma: corrupted data");
+				}
+
+				normalize();
+				ret = (ret << 1) + (t + 1);
+			}
+
+			return ret;
+		}
+
+		unsigned bit_tree(prob* probs, unsigned bits)
+		{
+			unsigned m = 1;
+			for (unsigned i = 0; i < bits; ++i) {
+				m = (m << 1) + bit(&probs[m]);
+			}
+			return m - (1 << bits);
+		}
+
+		unsigned bit_tree_reverse(prob* probs, unsigned bits)
+		{
+			unsigned m = 1;
+			unsigned symbol = 0;
+
+			for (unsigned i = 0; i < bits; ++i) {
+				unsigned b = bit(&probs[m]);
+				m = (m << 1) + b;
+				symbol |= b << i;
+			}
+
+			return symbol;
+		}
+
+		private:
+		void normalize()
+		{
+			if (m_range < (1 << 24)) {
+				m_range <<= 8;
+				m_code = (m_code << 8) | m_in.get();
+			}
+		}
+
+		byte_reader& m_in;
+		uint32_t m_range = 0xffffffff;
+		uint32_t m_code = 0;
+	};
+
+	struct len_decoder
+	{
+		len_decoder()
+		{
+			fill(begin(low), end(low), c_prob_init);
+			fill(begin(mid), end(mid), c_prob_init);
+			fill(begin(high), end(high), c_prob_init);
+		}
+
+		unsigned decode(range_decoder& rc, unsigned pos_state)
+		{
+			if (!rc.bit(&choice)) {
+				return rc.bit_tree(&low[pos_state << 3], 3);
+			} else if (!rc.bit(&choice2)) {
+				return 8 + rc.bit_tree(&mid[pos_state << 3], 3);
+			}
+
+			return 16 + rc.bit_tree(high, 8);
+		}
+
+		prob choice = c_prob_init;
+		prob choice2 = c_prob_init;
+		prob low[(1 << c_pos_bits_max) << 3];
+		prob mid[(1 << c_pos_bits_max) << 3];
+		prob high[1 << 8];
+	};
+
+	public:
+	virtual string name() const override
+	{ return "lzma"; }
+
+	virtual uint64_t decompress(istream& in, uint64_t length, ostream& out) override
+	{
+		byte_reader reader(in, length);
+		uint8_t props[5];
+
+		for (auto& b : props) {
+			b = reader.get();
+		}
+
+		if (props[0] >= 9 * 5 * 5) {
+			throw runtime_error("lzma: invalid properties");
+		}
+
+		m_lc = props[0] % 9;
+		m_lp = (props[0] / 9) % 5;
+		m_pb = props[0] / 45;
+
+		uint32_t dict_size = 0;
+		for (int i = 0; i < 4; ++i) {
+			dict_size |= uint32_t(props[i + 1]) << (8 * i);
+		}
+
+		if (dict_size > c_max_dict_size) {
+			throw runtime_error("lzma: dictionary size too large");
+		}
+
+		m_dict_size = max<uint32_t>(dict_size, 1 << 12);
+		m_size = read_size(reader);
+
+		uint32_t window = m_dict_size;
+		if (m_size != c_unknown_size && m_size < window) {
+			window = max<uint32_t>(m_size, 1);
+		}
+
+		out_window ow(out, window);
+		range_decoder rc(reader);
+
+		init_probs();
+		decode(rc, reader, ow);
+		ow.flush();
+
+		return ow.total();
+	}
+
+	private:
+	static constexpr uint64_t c_unknown_size = ~0ULL;
+
+	uint64_t read_size(byte_reader& reader)
+	{
+		// a range coder stream always starts with a NUL byte, so if the
+		// properties are followed by a plausible 64-bit size, and a NUL
+		// byte, we're looking at a .lzma style header.
+		if (reader.remaining() < 13) {
+			return c_unknown_size;
+		}
+
+		uint8_t buf[9];
+		for (auto& b : buf) {
+			b = reader.get();
+		}
+
+		uint64_t size = 0;
+		for (int i = 0; i < 8; ++i) {
+			size |= uint64_t(buf[i]) << (8 * i);
+		}
+
+		if (buf[8] == 0 && (size == c_unknown_size || size < (1ULL << 32))) {
+			reader.unget(1);
+			return size;
+		}
+
+		reader.unget(9);
+		return c_unknown_size;
+	}
+
+	void init_probs()
+	{
+		m_literal_probs.assign(0x300 << (m_lc + m_lp), c_prob_init);
+		m_pos_slot.assign(c_len_to_pos_states << 6, c_prob_init);
+		m_pos_decoders.assign(1 + c_full_distances - c_end_pos_model_index, c_prob_init);
+		m_align.assign(1 << c_align_bits, c_prob_init);
+
+		for (auto* v : { &m_is_match, &m_is_rep0_long }) {
+			v->assign(c_states << c_pos_bits_max, c_prob_init);
+		}
+
+		for (auto* v : { &m_is_rep, &m_is_rep_g0, &m_is_rep_g1, &m_is_rep_g2 }) {
+			v->assign(c_states, c_prob_init);
+		}
+
+		m_len = len_decoder();
+		m_rep_len = len_decoder();
+	}
+
+	void decode_literal(range_decoder& rc, out_window& ow, unsigned state, uint32_t rep0)
+	{
+		unsigned prev = ow.empty() ? 0 : ow.get(1);
+		unsigned lit_state = ((ow.total() & ((1 << m_lp) - 1)) << m_lc) + (prev >> (8 - m_lc));
+		prob* probs = &m_literal_probs[0x300 * lit_state];
+		unsigned symbol = 1;
+
+		if (state >= 7) {
+			unsigned match = ow.get(rep0 + 1);
+			do {
+				unsigned match_bit = (match >> 7) & 1;
+				match <<= 1;
+				unsigned b = rc.bit(&probs[((1 + match_bit) << 8) + symbol]);
+				symbol = (symbol << 1) | b;
+				if (match_bit != b) {
+					break;
+				}
+			} while (symbol < 0x100);
+		}
+
+		while (symbol < 0x100) {
+			symbol = (symbol << 1) | rc.bit(&probs[symbol]);
+		}
+
+		ow.put(symbol - 0x100);
+	}
+
+	uint32_t decode_distance(range_decoder& rc, unsigned len)
+	{
+		unsigned len_state = min(len, c_len_to_pos_states - 1);
+		unsigned pos_slot = rc.bit_tree(&m_pos_slot[len_state << 6], 6);
+
+		if (pos_slot < 4) {
+			return pos_slot;
+		}
+
+		unsigned direct_bits = (pos_slot >> 1) - 1;
+		uint32_t dist = (2 | (pos_slot & 1)) << direct_bits;
+
+		if (pos_slot < c_end_pos_model_index) {
+			dist += rc.bit_tree_reverse(&m_pos_decoders[dist - pos_slot], direct_bits);
+		} else {
+			dist += rc.direct_bits(direct_bits - c_align_bits) << c_align_bits;
+			dist += rc.bit_tree_reverse(m_align.data(), c_align_bits);
+		}
+
+		return dist;
+	}
+
+	void decode(range_decoder& rc, byte_reader& reader, out_window& ow)
+	{
+		uint32_t rep0 = 0, rep1 = 0, rep2 = 0, rep3 = 0;
+		unsigned state = 0;
+		uint64_t remaining = m_size;
+		bool size_known = m_size != c_unknown_size;
+
+		while (true) {
+			if (size_known && !remaining && rc.finished_ok()) {
+				return;
+			} else if (!size_known && !reader.remaining() && rc.finished_ok()) {
+				// raw stream without end marker
+				return;
+			}
+
+			unsigned pos_state = ow.total() & ((1 << m_pb) - 1);
+
+			if (!rc.bit(&m_is_match[(state << c_pos_bits_max) + pos_state])) {
+				if (size_known && !remaining) {
+					throw runtime_error("lzma: data after end of stream");
+				}
+
+				decode_literal(rc, ow, state, rep0);
+				state = state < 4 ? 0 : (state < 10 ? state - 3 : state - 6);
+				--remaining;
+				continue;
+			}
+
+			unsigned len;
+
+			if (rc.bit(&m_is_rep[state])) {
+				if ((size_known && !remaining) || ow.empty()) {
+					throw runtime_error("lzma: corrupted data");
+				}
+
+				if (!rc.bit(&m_is_rep_g0[state])) {
+					if (!rc.bit(&m_is_rep0_long[(state << c_pos_bits_max) + pos_state])) {
+						state = state < 7 ? 9 : 11;
+						ow.put(ow.get(rep0 + 1));
+						--remaining;
+						continue;
+					}
+				} else {
+					uint32_t dist;
+
+					if (!rc.bit(&m_is_rep_g1[state])) {
+						dist = rep1;
+					} else {
+						if (!rc.bit(&m_is_rep_g2[state])) {
+							dist = rep2;
+						} else {
+							dist = rep3;
+							rep3 = rep2;
+						}
+						rep2 = rep1;
+					}
+
+					rep1 = rep0;
+					rep0 = dist;
+				}
+
+				len = m_rep_len.decode(rc, pos_state);
+				state = state < 7 ? 8 : 11;
+			} else {
+				rep3 = rep2;
+				rep2 = rep1;
+				rep1 = rep0;
+				len = m_len.decode(rc, pos_state);
+				state = state < 7 ? 7 : 10;
+				rep0 = decode_distance(rc, len);
+
+				if (rep0 == 0xffffffff) {
+					if (!rc.finished_ok()) {
+						throw runtime_error("lzma: corrupted data");
+					}
+					// end marker
+					return;
+				} else if (size_known && !remaining) {
+					throw runtime_error("lzma: data after end of stream");
+				} else if (rep0 >= m_dict_size) {
+					throw runtime_error("lzma: invalid match distance");
+				}
+			}
+
+			len += c_match_min_len;
+			if (size_known && remaining < len) {
+				throw runtime_error("lzma: data after end of stream");
+			}
+
+			ow.copy(rep0 + 1, len);
+			remaining -= len;
+		}
+	}
+
+	unsigned m_lc, m_lp, m_pb;
+	uint32_t m_dict_size;
+	uint64_t m_size;
+
+	vector<prob> m_literal_probs;
+	vector<prob> m_pos_slot;
+	vector<prob> m_pos_decoders;
+	vector<prob> m_align;
+	vector<prob> m_is_match;
+	vector<prob> m_is_rep;
+	vector<prob> m_is_rep_g0;
+	vector<prob> m_is_rep_g1;
+	vector<prob> m_is_rep_g2;
+	vector<prob> m_is_rep0_long;
+	len_decoder m_len;
+	len_decoder m_rep_len;
+};
+
+constexpr lzma_decompressor::prob lzma_decompressor::c_prob_init;
+
+// LZO1X, as produced by miniLZO. Match distances are limited to 48k,
+// so a 64k window is sufficient.
+class lzo_decompressor : public decompressor
+{
+	static constexpr uint32_t c_window_size = 64 * 1024;
+	static constexpr uint32_t c_m2_max_offset = 0x0800;
+
+	public:
+	virtual string name() const override
+	{ return "mini-lzo"; }
+
+	virtual uint64_t decompress(istream& in, uint64_t length, ostream& out) override
+	{
+		byte_reader r(in, length);
+		out_window ow(out, c_window_size);
+
+		// number of literals following the last match (0-3), or 4
+		// if the last instruction was a literal run.
+		unsigned state = 0;
+		unsigned t = r.get();
+
+		if (t > 17) {
+			t -= 17;
+			copy_literals(r, ow, t);
+			state = t < 4 ? t : 4;
+			t = r.get();
+		}
+
+		while (true) {
+			uint32_t dist;
+			uint32_t len;
+
+			if (t < 16) {
+				if (!state) {
+					if (!t) {
+						t = 15 + zero_run(r);
+					}
+					copy_literals(r, ow, t + 3);
+					state = 4;
+					t = r.get();
+					continue;
+				} else if (state != 4) {
+					dist = 1 + (t >> 2) + (r.get() << 2);
+					len = 2;
+				} else {
+					dist = 1 + c_m2_max_offset + (t >> 2) + (r.get() << 2);
+					len = 3;
+				}
+			} else if (t >= 64) {
+				dist = 1 + ((t >> 2) & 7) + (r.get() << 3);
+				len = (t >> 5) + 1;
+			} else if (t >= 32) {
+				len = (t & 31) + 2;
+				if (len == 2) {
+					len += 31 + zero_run(r);
+				}
+				t = get_le16(r);
+				dist = 1 + (t >> 2);
+			} else {
+				dist = (t & 8) << 11;
+				len = (t & 7) + 2;
+				if (len == 2) {
+					len += 7 + zero_run(r);
+				}
+				t = get_le16(r);
+				dist += t >> 2;
+				if (!dist) {
+					// end of stream
+					if (len != 3) {
+						throw runtime_error("lzo: invalid end of stream");
+					}
+					break;
+				}
+				dist += 0x4000;
+			}
+
+			ow.copy(dist, len);
+
+			// the low 2 bits of the last instruction specify the
+			// number of literals that follow.
+			state = t & 3;
+			copy_literals(r, ow, state);
+			t = r.get();
+		}
+
+		ow.flush();
+
+		if (r.remaining()) {
+			logger::d() << "lzo: ignoring " << r.remaining() << " b of trailing data" << endl;
+		}
+
+		return ow.total();
+	}
+
+	private:
+	static unsigned zero_run(byte_reader& r)
+	{
+		unsigned n = 0;
+		uint8_t b;
+
+		while (!(b = r.get())) {
+			n += 255;
+		}
+
+		return n + b;
+	}
+
+	static unsigned get_le16(byte_reader& r)
+	{
+		unsigned ret = r.get();
+		return ret | (r.get() << 8);
+	}
+
+	static void copy_literals(byte_reader& r, out_window& ow, unsigned n)
+	{
+		while (n--) {
+			ow.put(r.get());
+		}
+	}
+};
+}
+
+decompressor::sp decompressor::create(uint16_t compression)
+{
+	switch (compression) {
+	case ps_header::c_comp_lz:
+	case ps_header::c_comp_lza:
+		return make_shared<lzma_decompressor>();
+	case ps_header::c_comp_mini_lzo:
+		return make_shared<lzo_decompressor>();
+	default:
+		return nullptr;
+	}
+}
+}
@@ -0,0 +1,50 @@
+/**
+ * bcm2-utils
+ * Copyright (C) 2016-2018 Joseph Lehner <joseph.c.lehner@gmail.com>
+ *
+ * bcm2-utils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bcm2-utils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with bcm2-utils.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef BCM2DUMP_DECOMPRESS_H
+#define BCM2DUMP_DECOMPRESS_H
+#include <iostream>
+#include <memory>
+#include <string>
+
+namespace bcm2dump {
+
+// streaming decompressors for ProgramStore image payloads. memory usage
+// is bounded by the size of the algorithm's sliding window, not by the
+// size of the image.
+class decompressor
+{
+	public:
+	typedef std::shared_ptr<decompressor> sp;
+
+	virtual ~decompressor() {}
+
+	virtual std::string name() const = 0;
+
+	// decompresses `length` bytes read from `in`, and writes the
+	// result to `out`. returns the size of the decompressed data.
+	virtual uint64_t decompress(std::istream& in, uint64_t length, std::ostream& out) = 0;
+
+	// returns a decompressor for a ProgramStore compression type,
+	// or nullptr if the type is not supported.
+	static sp create(uint16_t compression);
+};
+}
+
+#endif
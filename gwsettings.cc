@@ -18,6 +18,10 @@
  */
 
 #include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <mutex>
 #include "gwsettings.h"
 #include "crypto.h"
 using namespace std;
@@ -28,12 +32,36 @@ namespace bcm2cfg {
 namespace {
 string read_stream(istream& is)
 {
+	// if the stream is seekable, read the remaining data in one go
+	auto pos = is.tellg();
+	if (pos != -1 && is.seekg(0, ios::end)) {
+		auto end = is.tellg();
+		is.seekg(pos);
+
+		string buf(max<streamoff>(end - pos, 0), '\0');
+		is.read(&buf[0], buf.size());
+		buf.resize(is.gcount());
+		return buf;
+	}
+
+	is.clear();
 	return string(std::istreambuf_iterator<char>(is), {});
 }
 
-string gws_checksum(string buf, const csp<profile>& p)
+// takes a copy of the hash state, so that the same state can be finished with
+// the keys of multiple profiles
+string gws_checksum(md5 hash, const csp<profile>& p)
+{
+	if (p) {
+		hash.update(p->md5_key());
+	}
+
+	return hash.final();
+}
+
+string gws_checksum(const string& buf, const csp<profile>& p)
 {
-	return hash_md5(buf + (p ? p->md5_key() : ""));
+	return gws_checksum(md5().update(buf), p);
 }
 
 unsigned log2(unsigned num)
@@ -55,20 +83,26 @@ unsigned pow2(unsigned num)
 	return ret;
 }
 
-string gws_crypt(const string& buf, const string& key, int type, bool encrypt)
+void gws_crypt(string& buf, const string& key, int type, bool encrypt)
 {
+	if (buf.empty()) {
+		return;
+	}
+
 	if (type == BCM2_CFG_ENC_AES256_ECB) {
-		return crypt_aes_256_ecb(buf, key, encrypt);
+		crypt_aes_256_ecb(&buf[0], buf.size(), key, encrypt);
 	} else if (type == BCM2_CFG_ENC_AES128_CBC) {
-		return crypt_aes_128_cbc(buf, key, encrypt);
+		crypt_aes_128_cbc(&buf[0], buf.size(), key, encrypt);
 	} else if (type == BCM2_CFG_ENC_3DES_ECB) {
-		return crypt_3des_ecb(buf, key, encrypt);
+		crypt_3des_ecb(&buf[0], buf.size(), key, encrypt);
 	} else if (type == BCM2_CFG_ENC_DES_ECB) {
-		return crypt_des_ecb(buf, key, encrypt);
+		crypt_des_ecb(&buf[0], buf.size(), key, encrypt);
 	} else if (type == BCM2_CFG_ENC_SUB_16x16) {
-		return crypt_sub_16x16(buf, encrypt);
+		crypt_sub_16x16(&buf[0], buf.size(), encrypt);
 	} else if (type == BCM2_CFG_ENC_XOR) {
-		return crypt_xor_char(buf, key);
+		crypt_xor_char(&buf[0], buf.size(), key);
+	} else if (type == BCM2_CFG_ENC_MOTOROLA) {
+		crypt_motorola(&buf[0], buf.size(), key);
 	} else {
 		throw runtime_error("invalid encryption type " + to_string(type));
 	}
@@ -102,7 +136,7 @@ bool gws_unpad(string& buf, const csp<profile>& p)
 		unsigned expected = blksize - (((buf.size() + 16) - padnum) % blksize);
 
 		if (padnum == expected || (expected == 0 && padnum == blksize && !pad_optional)) {
-			logger::d() << "padding=" << to_hex(buf.substr(buf.size() - padnum)) << endl;
+			LOG_D() << "padding=" << to_hex(buf.substr(buf.size() - padnum)) << endl;
 			buf.resize(buf.size() - padnum);
 			return true;
 		}
@@ -132,61 +166,81 @@ bool gws_unpad(string& buf, const csp<profile>& p)
 		return false;
 	}
 
-	logger::v() << "failed to remove padding" << endl;
+	LOG_V() << "failed to remove padding" << endl;
 	return false;
 }
 
-string gws_decrypt(string buf, string& checksum, string& key, const csp<profile>& p, bool& padded)
+// the encrypted data is not modified, since decryption is attempted
+// with multiple profiles and keys. if `probe` is non-zero, only the first
+// `probe` bytes (a multiple of the block size) are decrypted, and padding
+// is left as-is; this is enough to check for the magic.
+string gws_decrypt(const string& encrypted, string& checksum, string& key, const csp<profile>& p, bool& padded,
+		size_t probe = 0)
 {
 	int flags = p->cfg_flags();
 	int enc = p->cfg_encryption();
 
-	logger::d() << "decrypting with profile " << p->name() << endl;
+	LOG_D() << "decrypting with profile " << p->name() << endl;
+
+	// offset of the encrypted data within `encrypted`
+	size_t beg = 0;
 
 	if (flags & BCM2_CFG_FMT_GWS_LEN_PREFIX) {
 		auto len = ntoh(extract<uint32_t>(checksum));
-		if (len == (buf.size() + 12)) {
+		if (len == (encrypted.size() + 12)) {
 			checksum.erase(0, 4);
-			checksum.append(buf.substr(0, 4));
-			buf.erase(0, 4);
+			checksum.append(encrypted, 0, 4);
+			beg = 4;
 		} else {
-			logger::d() << "unexpected length prefix: " << len << endl;
+			LOG_D() << "unexpected length prefix: " << len << endl;
 		}
 	} else if (flags & BCM2_CFG_FMT_GWS_CLEN_PREFIX) {
 		if (checksum == "Content-Length: ") {
-			auto pos = buf.find("\r\n\r\n");
-			auto len = lexical_cast<uint32_t>(buf.substr(0, pos));
-			auto beg = pos + 4;
+			auto pos = encrypted.find("\r\n\r\n");
+			auto len = lexical_cast<uint32_t>(encrypted.substr(0, pos));
+			beg = pos + 4;
 
-			if (len != (buf.size() - beg)) {
-				logger::d() << "unexpected length prefix: " << len << endl;
+			if (len != (encrypted.size() - beg)) {
+				LOG_D() << "unexpected length prefix: " << len << endl;
 			}
 
-			checksum = buf.substr(beg, 16);
-			buf = buf.substr(beg + 16);
+			checksum = encrypted.substr(beg, 16);
+			beg = min(beg + 16, encrypted.size());
 		} else {
-			logger::d() << "length prefix is missing" << endl;
+			LOG_D() << "length prefix is missing" << endl;
 		}
 	}
 
-	if (flags & BCM2_CFG_FMT_GWS_FULL_ENC) {
-		buf = checksum + buf;
-	}
+	// with FULL_ENC, the checksum is encrypted as well
+	static const string none;
+	const string& head = (flags & BCM2_CFG_FMT_GWS_FULL_ENC) ? checksum : none;
+	size_t size = head.size() + encrypted.size() - beg;
 
 	if (enc == BCM2_CFG_ENC_MOTOROLA) {
+		// the last byte is the key
 		if (key.empty()) {
-			key = buf.back();
+			key = (encrypted.size() > beg) ? encrypted.back() : head.back();
 		}
-		buf = crypt_motorola(buf.substr(0, buf.size() - 1), key);
-	} else {
-		buf = gws_crypt(buf, key, enc, false);
+		--size;
+	}
+
+	if (probe) {
+		size = min(probe, size);
 	}
 
-	padded = gws_unpad(buf, p);
+	// copy only what is decrypted, then decrypt in-place
+	string buf;
+	buf.reserve(size);
+	buf.append(head, 0, size);
+	buf.append(encrypted, beg, size - buf.size());
+
+	gws_crypt(buf, key, enc, false);
+
+	padded = !probe && gws_unpad(buf, p);
 
 	if (flags & BCM2_CFG_FMT_GWS_FULL_ENC) {
 		checksum = buf.substr(0, 16);
-		buf = buf.substr(16);
+		buf.erase(0, 16);
 	}
 
 	return buf;
@@ -198,18 +252,19 @@ string gws_encrypt(string buf, const string& key, const csp<profile>& p, bool pa
 	int enc = p->cfg_encryption();
 
 	if (flags & BCM2_CFG_FMT_GWS_FULL_ENC) {
-		buf = gws_checksum(buf, p) + buf;
+		buf.insert(0, gws_checksum(buf, p));
 	}
 
 	// TODO move all padding stuff to crypto.cc
 
 	if (!(flags & BCM2_CFG_FMT_GWS_PAD_OPTIONAL) && !pad) {
 		pad = true;
-		logger::d() << "force-enabling padding" << endl;
+		LOG_D() << "force-enabling padding" << endl;
 	}
 
 	if (enc == BCM2_CFG_ENC_MOTOROLA) {
-		return crypt_motorola(buf, key) + key;
+		gws_crypt(buf, key, enc, true);
+		return buf += key;
 	} else if (enc != BCM2_CFG_ENC_NONE) {
 		if (pad) {
 			int padding = p->cfg_padding();
@@ -235,13 +290,13 @@ string gws_encrypt(string buf, const string& key, const csp<profile>& p, bool pa
 			}
 		}
 
-		buf = gws_crypt(buf, key, enc, true);
+		gws_crypt(buf, key, enc, true);
 	} else {
 		throw user_error("profile " + p->name() + " does not support encryption");
 	}
 
 	if (!(flags & BCM2_CFG_FMT_GWS_FULL_ENC)) {
-		buf = gws_checksum(buf, p) + buf;
+		buf.insert(0, gws_checksum(buf, p));
 	}
 
 	if (flags & BCM2_CFG_FMT_GWS_LEN_PREFIX) {
@@ -373,7 +428,7 @@ class permdyn : public encryptable_settings
 					m_write_count = 0;
 				} else {
 					offset = segment_size * min(m_write_count, 16u);
-					logger::d() << "write count: " << m_write_count << ", offset: " << offset << endl;
+					LOG_D() << "write count: " << m_write_count << ", offset: " << offset << endl;
 				}
 			}
 
@@ -416,15 +471,15 @@ class permdyn : public encryptable_settings
 			m_size_valid = true;
 		}
 
-		// minus 8, since m_size includes itself (4 bytes) plus the checksum (also 4 bytes)
-		uint32_t checksum = calc_checksum(buf.substr(0, m_size.num() - 8));
+		// buf is m_size - 8 bytes long, since m_size includes itself (4 bytes) plus the checksum (also 4 bytes)
+		uint32_t checksum = calc_checksum(buf);
 		m_checksum_valid = checksum == m_checksum.num();
 
 		if (!m_checksum_valid) {
-			logger::d() << type() << ": checksum mismatch: " << to_hex(checksum) << " / " << to_hex(m_checksum.num()) << endl;
+			LOG_D() << type() << ": checksum mismatch: " << to_hex(checksum) << " / " << to_hex(m_checksum.num()) << endl;
 		}
 
-		istringstream istr(buf);
+		imemstream istr(buf);
 		settings::read(istr);
 
 		if (!key().empty()) {
@@ -438,8 +493,9 @@ class permdyn : public encryptable_settings
 			auto unenc_groups = parts();
 
 			m_parts.clear();
-			istr.str(crypt_aes_256_ecb(istr.str(), key(), false));
-			settings::read(istr);
+			string decrypted = crypt_aes_256_ecb(buf, key(), false);
+			imemstream dstr(decrypted);
+			settings::read(dstr);
 
 			if (unenc_groups.size() > parts().size()) {
 				// more groups when not decrypted -> file isn't encrypted
@@ -473,8 +529,8 @@ class permdyn : public encryptable_settings
 
 		string buf = ostr.str();
 
-		if (!key().empty()) {
-			buf = crypt_aes_256_ecb(buf, key(), true);
+		if (!key().empty() && !buf.empty()) {
+			crypt_aes_256_ecb(&buf[0], buf.size(), key(), true);
 		}
 
 		ostr.str("");
@@ -511,9 +567,9 @@ class permdyn : public encryptable_settings
 				// all firmwares seem to include at least some padding in between, and
 				// some of those align the offset to 0x1000 (or 0x100?).
 
-				if (align_left(segment_size, 0x1000) < diff) {
+				if (align_right(segment_size, 0x1000) <= diff) {
 					segment_size = align_right(segment_size, 0x1000);
-				} else if (align_left(segment_size, 0x100) < diff) {
+				} else if (align_right(segment_size, 0x100) <= diff) {
 					segment_size = align_right(segment_size, 0x100);
 				}
 
@@ -575,21 +631,21 @@ class permdyn : public encryptable_settings
 		uint32_t sum = buf.size() + 8;
 
 		while (remaining >= 4) {
-			sum += ntoh(extract<uint32_t>(buf.substr(buf.size() - remaining, 4)));
+			sum += ntoh(extract<uint32_t>(buf, buf.size() - remaining));
 			remaining -= 4;
 		}
 
 		uint16_t half = 0;
 
 		if (remaining >= 2) {
-			half = ntoh(extract<uint16_t>(buf.substr(buf.size() - remaining, 2)));
+			half = ntoh(extract<uint16_t>(buf, buf.size() - remaining));
 			remaining -= 2;
 		}
 
 		uint8_t byte = 0;
 
 		if (remaining) {
-			byte = extract<uint8_t>(buf.substr(buf.size() - remaining, 1));
+			byte = extract<uint8_t>(buf, buf.size() - remaining);
 		}
 
 		sum += ((byte | (half << 8)) << 8);
@@ -658,12 +714,89 @@ class gwsettings : public encryptable_settings
 			m_key = m_pw = "";
 		}
 
-		istringstream istr(buf.substr(m_magic.size()));
+		imemstream istr(buf.data() + m_magic.size(), buf.size() - m_magic.size());
 		read_header(istr, buf.size());
 		settings::read(istr);
 		return is;
 	}
 
+	crack_status crack(istream& is, const password_source& source, uint64_t start,
+			const function<void(const crack_status&)>& progress)
+	{
+		string buf = read_stream(is);
+
+		clip_circumfix(buf);
+
+		if (validate_magic(buf)) {
+			throw user_error("file is not encrypted");
+		}
+
+		// narrows it down to one profile, if the checksum can be verified
+		validate_checksum_and_detect_profile(buf);
+
+		vector<csp<bcm2dump::profile>> profiles;
+		vector<csp<bcm2dump::profile>> candidates { profile() };
+
+		if (!profile()) {
+			auto& all = profile::list();
+			candidates.assign(all.begin(), all.end());
+		}
+
+		for (auto p : candidates) {
+			try {
+				p->derive_key("");
+				profiles.push_back(p);
+			} catch (const exception& e) {
+				if (profile()) {
+					throw user_error(e.what());
+				}
+			}
+		}
+
+		if (profiles.empty()) {
+			throw user_error("no profile supports password-based encryption");
+		}
+
+		crack_status status;
+		status.next = start;
+
+		auto beg = chrono::steady_clock::now();
+		uint64_t total = source.size();
+		uint64_t np = profiles.size();
+
+		while (status.next < total) {
+			uint64_t n = min(uint64_t(c_crack_batch), total - status.next);
+
+			// for every candidate, try all profiles
+			size_t i = parallel_find_first(n * np, default_jobs(), [&] (size_t i) {
+				auto& p = profiles[i % np];
+				decrypted d;
+				return try_key(buf, p, p->derive_key(source.at(status.next + i / np)), d);
+			});
+
+			if (i < (n * np)) {
+				status.found = true;
+				status.index = status.next + i / np;
+				status.profile = profiles[i % np];
+				n = i / np + 1;
+			}
+
+			status.next += n;
+			status.tested += n;
+
+			chrono::duration<double> elapsed = chrono::steady_clock::now() - beg;
+			status.keys_per_sec = elapsed.count() ? (status.tested * np) / elapsed.count() : 0;
+
+			progress(status);
+
+			if (status.found) {
+				break;
+			}
+		}
+
+		return status;
+	}
+
 	virtual ostream& write(ostream& os) const override
 	{
 		if (!profile()) {
@@ -684,17 +817,18 @@ class gwsettings : public encryptable_settings
 		m_size.write(ostr);
 #endif
 
-		buf = ostr.str() + buf;
+		buf.insert(0, ostr.str());
 
 		if (!m_key.empty()) {
-			buf = gws_encrypt(buf, m_key, m_profile, m_padded);
+			buf = gws_encrypt(move(buf), m_key, m_profile, m_padded);
 		} else {
-			buf = gws_checksum(buf, m_profile) + buf;
+			buf.insert(0, gws_checksum(buf, m_profile));
 		}
 
-		buf = m_circumfix + buf + m_circumfix;
+		os.write(m_circumfix.data(), m_circumfix.size());
+		os.write(buf.data(), buf.size());
 
-		if (!(os.write(buf.data(), buf.size()))) {
+		if (!(os.write(m_circumfix.data(), m_circumfix.size()))) {
 			throw runtime_error("error while writing data");
 		}
 
@@ -719,18 +853,29 @@ class gwsettings : public encryptable_settings
 		if (top == btm) {
 			m_circumfix = top;
 			m_checksum = m_checksum.substr(12) + buf.substr(0, 12);
-			buf = buf.substr(12, buf.size() - 24);
+			buf.resize(buf.size() - 12);
+			buf.erase(0, 12);
 		}
 	}
 
+	static unsigned detection_jobs()
+	{
+		// trials log from multiple threads otherwise
+		return logger::enabled(logger::verbose) ? 1 : default_jobs();
+	}
+
 	void validate_checksum_and_detect_profile(const string& buf)
 	{
 
 		if (this->profile()) {
 			validate_checksum(buf, this->profile());
 		} else {
+			md5 hash;
+			hash.update(buf);
+
 			for (auto p : profile::list()) {
-				if (validate_checksum(buf, p)) {
+				if (m_checksum == gws_checksum(hash, p)) {
+					m_checksum_valid = true;
 					m_is_auto_profile = true;
 					m_profile = p;
 					break;
@@ -746,6 +891,12 @@ class gwsettings : public encryptable_settings
 	}
 
 	bool validate_magic(const string& buf)
+	{
+		m_magic_valid = detect_magic(buf, m_magic);
+		return m_magic_valid;
+	}
+
+	static bool detect_magic(const string& buf, string& magic_out)
 	{
 		// The magic values on Sagem 3686 modems (and possibly others) are ISP-dependent:
 		//
@@ -765,17 +916,16 @@ class gwsettings : public encryptable_settings
 
 		for (const string& magic : magics) {
 			if (starts_with(buf, magic)) {
-				m_magic_valid = true;
-				m_magic = magic;
-				break;
+				magic_out = magic;
+				return true;
 			}
 		}
 
-		if (!m_magic_valid) {
+		{
 			auto pos = buf.find(magic2_part2);
 			if (pos != string::npos) {
-				m_magic_valid = true;
-				m_magic = buf.substr(0, pos + magic2_part2.size());
+				magic_out = buf.substr(0, pos + magic2_part2.size());
+				return true;
 			} else {
 				auto it = find_if(buf.begin(), buf.end(), [] (char c) {
 						return c != '-' && !isalnum(c);
@@ -788,18 +938,18 @@ class gwsettings : public encryptable_settings
 
 					string magic(buf.begin(), it);
 					if (magic.size() >= magic2_part2.size() && magic.size() <= longest->size()) {
-						logger::v() << "magic detected by brute force" << endl;
-						m_magic_valid = true;
-						m_magic = magic;
+						LOG_V() << "magic detected by brute force" << endl;
+						magic_out = magic;
+						return true;
 					}
 				}
 			}
 		}
 
-		return m_magic_valid;
+		return false;
 	}
 
-	void read_header(istringstream& istr, size_t bufsize)
+	void read_header(istream& istr, size_t bufsize)
 	{
 		m_size.num(0);
 
@@ -815,12 +965,26 @@ class gwsettings : public encryptable_settings
 		m_size_valid = m_size.num() == bufsize;
 
 		if (!m_size_valid && bufsize > m_size.num()) {
-			logger::v() << "data size exceeds reported file size" << endl;
+			LOG_V() << "data size exceeds reported file size" << endl;
 			m_size.num(bufsize);
 		}
 	}
 
-	bool decrypt_with_profile(string& buf, const csp<bcm2dump::profile>& p)
+	// longest magic (74 bytes) plus checksum, rounded up to the block size
+	static constexpr size_t c_probe_bytes = 128;
+	// number of passwords tested by gws_crack() before reporting progress
+	static constexpr uint64_t c_crack_batch = 1 << 16;
+
+	struct decrypted
+	{
+		string buf;
+		string key;
+		string checksum;
+		bool padded;
+	};
+
+	// doesn't modify the object, so this can be called from multiple threads
+	bool try_decrypt(const string& buf, const csp<bcm2dump::profile>& p, decrypted& result) const
 	{
 		if (!p || !p->cfg_encryption()) {
 			return false;
@@ -839,34 +1003,73 @@ class gwsettings : public encryptable_settings
 		}
 
 		for (auto key : keys) {
-			string tmpsum = m_checksum;
-			string tmpbuf;
-			bool padded;
-
-			try {
-				tmpbuf = gws_decrypt(buf, tmpsum, key, p, padded);
-			} catch (const invalid_argument& e) {
-				logger::t() << e.what() << endl;
-				continue;
+			if (try_key(buf, p, key, result)) {
+				return true;
 			}
+		}
 
-			if (validate_magic(tmpbuf)) {
-				m_key = key;
-				buf = tmpbuf;
-				m_padded = padded;
-
-				if (!m_checksum_valid) {
-					m_checksum = tmpsum;
-					validate_checksum(buf, p);
-				}
+		return false;
+	}
 
-				return true;
+	bool try_key(const string& buf, const csp<bcm2dump::profile>& p, string key, decrypted& result) const
+	{
+		string tmpsum = m_checksum;
+		string tmpbuf;
+		string magic;
+		bool padded;
+
+		try {
+			// decrypt the first few blocks only, and only decrypt the
+			// whole file if these contain a valid magic
+			string probesum = m_checksum;
+			string probekey = key;
+
+			tmpbuf = gws_decrypt(buf, probesum, probekey, p, padded, c_probe_bytes);
+			if (!detect_magic(tmpbuf, magic)) {
+				return false;
 			}
+
+			tmpbuf = gws_decrypt(buf, tmpsum, key, p, padded);
+		} catch (const invalid_argument& e) {
+			LOG_T() << e.what() << endl;
+			return false;
+		}
+
+		if (detect_magic(tmpbuf, magic)) {
+			result.buf.swap(tmpbuf);
+			result.key = key;
+			result.checksum = tmpsum;
+			result.padded = padded;
+			return true;
 		}
 
 		return false;
 	}
 
+	void use_decrypted(string& buf, decrypted& d, const csp<bcm2dump::profile>& p)
+	{
+		validate_magic(d.buf);
+		m_key = d.key;
+		buf.swap(d.buf);
+		m_padded = d.padded;
+
+		if (!m_checksum_valid) {
+			m_checksum = d.checksum;
+			validate_checksum(buf, p);
+		}
+	}
+
+	bool decrypt_with_profile(string& buf, const csp<bcm2dump::profile>& p)
+	{
+		decrypted d;
+		if (!try_decrypt(buf, p, d)) {
+			return false;
+		}
+
+		use_decrypted(buf, d, p);
+		return true;
+	}
+
 	bool decrypt_and_detect_profile(string& buf)
 	{
 		if (profile()) {
@@ -877,12 +1080,21 @@ class gwsettings : public encryptable_settings
 			}
 		}
 
-		for (auto p : profile::list()) {
-			if (decrypt_with_profile(buf, p)) {
-				m_is_auto_profile = true;
-				m_profile = p;
-				return true;
-			}
+		// all profiles are tried in parallel, but the first matching one
+		// (in list order) is used, as if they were tried one by one.
+
+		auto& profiles = profile::list();
+		vector<decrypted> results(profiles.size());
+
+		size_t i = parallel_find_first(profiles.size(), detection_jobs(), [&] (size_t i) {
+			return try_decrypt(buf, profiles[i], results[i]);
+		});
+
+		if (i < profiles.size()) {
+			use_decrypted(buf, results[i], profiles[i]);
+			m_is_auto_profile = true;
+			m_profile = profiles[i];
+			return true;
 		}
 
 		return false;
@@ -901,18 +1113,183 @@ class gwsettings : public encryptable_settings
 	string m_circumfix;
 	bool m_padded = false;
 };
+
+class dictionary_source : public password_source
+{
+	public:
+	dictionary_source(const string& filename)
+	: m_file(filename, ios::binary)
+	{
+		if (!m_file.good()) {
+			throw user_error("failed to open " + filename);
+		}
+
+		// only the offset of each line is kept, so the file is read in
+		// blocks, and its checksum is calculated along the way.
+		string buf(64 * 1024, '\0');
+		uint64_t offset = 0;
+		bool line_start = true;
+		md5 hash;
+
+		while (m_file.read(&buf[0], buf.size()) || m_file.gcount()) {
+			size_t n = m_file.gcount();
+			hash.update(buf.data(), n);
+
+			for (size_t i = 0; i < n; ++i) {
+				if (line_start) {
+					m_offsets.push_back(offset + i);
+				}
+
+				auto nl = static_cast<const char*>(memchr(&buf[i], '\n', n - i));
+				if (!nl) {
+					line_start = false;
+					break;
+				}
+
+				i = nl - buf.data();
+				line_start = true;
+			}
+
+			offset += n;
+		}
+
+		if (m_file.bad()) {
+			throw user_error("failed to read " + filename);
+		}
+
+		m_size = offset;
+		m_checksum = hash.final();
+		m_file.clear();
+	}
+
+	virtual uint64_t size() const override
+	{ return m_offsets.size(); }
+
+	virtual string at(uint64_t i) const override
+	{
+		uint64_t beg = m_offsets.at(i);
+		string line((i + 1) < m_offsets.size() ? m_offsets[i + 1] - beg : m_size - beg, '\0');
+
+		{
+			lock_guard<mutex> guard(m_lock);
+			if (!m_file.seekg(beg) || !m_file.read(&line[0], line.size())) {
+				m_file.clear();
+				throw runtime_error("failed to read candidate " + ::to_string(i));
+			}
+		}
+
+		if (!line.empty() && line.back() == '\n') {
+			line.pop_back();
+		}
+
+		if (!line.empty() && line.back() == '\r') {
+			line.pop_back();
+		}
+
+		return line;
+	}
+
+	virtual string checksum() const override
+	{ return m_checksum; }
+
+	private:
+	mutable ifstream m_file;
+	mutable mutex m_lock;
+	vector<uint64_t> m_offsets;
+	uint64_t m_size = 0;
+	string m_checksum;
+};
+
+class mask_source : public password_source
+{
+	public:
+	mask_source(const string& mask)
+	{
+		const string lower = "abcdefghijklmnopqrstuvwxyz";
+		const string upper = "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+		const string digits = "0123456789";
+		const string special = " !\"#$%&'()*+,-./:;<=>?@[\\]^_`{|}~";
+
+		for (size_t i = 0; i < mask.size(); ++i) {
+			if (mask[i] != '?') {
+				m_charsets.push_back(string(1, mask[i]));
+				continue;
+			} else if (++i == mask.size()) {
+				throw user_error("invalid mask: " + mask);
+			}
+
+			switch (mask[i]) {
+			case 'l':
+				m_charsets.push_back(lower);
+				break;
+			case 'u':
+				m_charsets.push_back(upper);
+				break;
+			case 'd':
+				m_charsets.push_back(digits);
+				break;
+			case 's':
+				m_charsets.push_back(special);
+				break;
+			case 'a':
+				m_charsets.push_back(lower + upper + digits + special);
+				break;
+			case '?':
+				m_charsets.push_back("?");
+				break;
+			default:
+				throw user_error("invalid mask: " + mask);
+			}
+		}
+
+		m_size = 1;
+
+		for (auto& cs : m_charsets) {
+			if (m_size > (UINT64_MAX / cs.size())) {
+				throw user_error("mask yields too many candidates: " + mask);
+			}
+			m_size *= cs.size();
+		}
+	}
+
+	virtual uint64_t size() const override
+	{ return m_size; }
+
+	virtual string at(uint64_t i) const override
+	{
+		string ret(m_charsets.size(), '\0');
+
+		// the last character changes fastest
+		for (size_t k = m_charsets.size(); k; --k) {
+			auto& cs = m_charsets[k - 1];
+			ret[k - 1] = cs[i % cs.size()];
+			i /= cs.size();
+		}
+
+		return ret;
+	}
+
+	private:
+	vector<string> m_charsets;
+	uint64_t m_size;
+};
 }
 
 istream& settings::read(istream& is)
 {
 	m_groups.clear();
+	m_index.clear();
+
+	nv_arena::scope scope(m_arena.get());
 
 	sp<nv_group> group;
 	size_t remaining = data_bytes();
 	unsigned mult = 1;
 
 	while (remaining >= 8 && !is.eof()) {
-		if (!nv_group::read(is, group, m_format, remaining, m_profile) || !group) {
+		auto pos = is.tellg();
+
+		if (!nv_group::read(is, group, m_format, remaining, m_profile, m_lazy) || !group) {
 			if (is.eof() || !group) {
 				break;
 			}
@@ -922,10 +1299,13 @@ istream& settings::read(istream& is)
 			string name = group->name();
 			if (find(name)) {
 				name += "_" + std::to_string(++mult);
-				logger::v() << "redefinition of " << group->name() << " renamed to " << name << endl;
+				LOG_V() << "redefinition of " << group->name() << " renamed to " << name << endl;
 			}
+			m_index[name] = m_groups.size();
 			m_groups.push_back( { name, group });
-			remaining -= group->bytes();
+			// a decoded group's size may differ from the number of bytes
+			// it was read from (see nv_group::read)
+			remaining -= is.eof() ? remaining : size_t(is.tellg() - pos);
 		}
 	}
 
@@ -942,13 +1322,33 @@ void settings::remove(const string& name)
 	auto it = find_if(m_groups.begin(), m_groups.end(), [name](const nv_val::named& v) { return v.name == name; });
 	if (it != m_groups.end()) {
 		m_groups.erase(it);
+		index_groups();
 	} else {
 		throw user_error("no such group: " + name);
 	}
 }
 
+csp<nv_val> settings::find_member(const string& name) const
+{
+	auto it = m_index.find(name);
+	if (it == m_index.end() || m_groups[it->second].val->is_disabled()) {
+		return nullptr;
+	}
+
+	return m_groups[it->second].val;
+}
+
+void settings::index_groups()
+{
+	m_index.clear();
+
+	for (size_t i = 0; i < m_groups.size(); ++i) {
+		m_index.emplace(m_groups[i].name, i);
+	}
+}
+
 sp<settings> settings::read(istream& is, int format, const csp<bcm2dump::profile>& p, const string& key,
-		const string& pw)
+		const string& pw, bool lazy)
 {
 	sp<settings> ret;
 	string start(16, '\0');
@@ -975,14 +1375,31 @@ sp<settings> settings::read(istream& is, int format, const csp<bcm2dump::profile
 	}
 
 	if (ret) {
+		ret->m_lazy = lazy;
 		ret->read(is);
 	}
 
 	return ret;
 }
 
+sp<password_source> password_source::dictionary(const string& filename)
+{
+	return make_shared<dictionary_source>(filename);
+}
 
+sp<password_source> password_source::mask(const string& mask)
+{
+	return make_shared<mask_source>(mask);
+}
 
+crack_status gws_crack(istream& is, const csp<bcm2dump::profile>& p, const password_source& source,
+		uint64_t start, const function<void(const crack_status&)>& progress)
+{
+	string checksum(16, '\0');
+	if (!is.read(&checksum[0], checksum.size())) {
+		throw runtime_error("failed to read file");
+	}
 
-
+	return gwsettings(checksum, p, "", "").crack(is, source, start, progress);
+}
 }
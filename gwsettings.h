@@ -19,6 +19,8 @@
 
 #ifndef BCM2CFG_GWSETTINGS_HH
 #define BCM2CFG_GWSETTINGS_HH
+#include <unordered_map>
+#include <functional>
 #include "nonvol2.h"
 #include "profile.h"
 
@@ -46,8 +48,11 @@ class settings : public nv_compound
 	virtual std::string header_to_string() const = 0;
 	virtual bool is_valid() const = 0;
 
+	// with `lazy` set, settings groups are only decoded when accessed. since
+	// this modifies the object, it must not be used by multiple threads at
+	// the same time (which is also true for its nv_arena).
 	static sp<settings> read(std::istream& is, int type, const csp<bcm2dump::profile>& profile,
-			const std::string& key, const std::string& password);
+			const std::string& key, const std::string& password, bool lazy = false);
 
 	virtual std::ostream& write(std::ostream& is) const override;
 
@@ -56,9 +61,17 @@ class settings : public nv_compound
 
 	virtual void remove(const std::string& name);
 
+	virtual ~settings()
+	{
+		// these may have been allocated from m_arena
+		m_groups.clear();
+		m_parts.clear();
+	}
+
 	protected:
 	settings(const std::string& name, int format, const csp<bcm2dump::profile>& p)
-	: nv_compound(true, name), m_profile(p), m_format(format) {}
+	: nv_compound(true, name), m_profile(p), m_format(format),
+	  m_arena(new nv_arena) {}
 
 	virtual std::istream& read(std::istream& is) override;
 
@@ -68,13 +81,21 @@ class settings : public nv_compound
 	csp<bcm2dump::profile> m_profile;
 
 	void groups(const list& g)
-	{ m_groups = g; }
+	{ m_groups = g; index_groups(); }
+
+	virtual csp<nv_val> find_member(const std::string& name) const override;
 
 	protected:
 	int m_format;
+	bool m_lazy = false;
 
 	private:
+	void index_groups();
+
+	// holds the groups read by read(), so it must outlive m_groups
+	std::unique_ptr<nv_arena> m_arena;
 	list m_groups;
+	std::unordered_map<std::string, size_t> m_index;
 };
 
 class encryptable_settings : public settings
@@ -88,6 +109,51 @@ class encryptable_settings : public settings
 	protected:
 	using settings::settings;
 };
+
+// candidate passwords for gws_crack(). candidates are accessed by index, so
+// that an interrupted search can be resumed.
+class password_source
+{
+	public:
+	virtual ~password_source() {}
+
+	virtual uint64_t size() const = 0;
+	// must be thread-safe
+	virtual std::string at(uint64_t i) const = 0;
+	// checksum of the file the candidates are read from, if any
+	virtual std::string checksum() const
+	{ return ""; }
+
+	// one password per line. only the offset of each line is kept in
+	// memory; candidates are read from the file as needed.
+	static sp<password_source> dictionary(const std::string& filename);
+	// every character of the mask is used as-is, except for ?l (a-z),
+	// ?u (A-Z), ?d (0-9), ?s (special characters), ?a (all of these)
+	// and ?? (a literal '?').
+	static sp<password_source> mask(const std::string& mask);
+};
+
+struct crack_status
+{
+	// index of the first candidate that hasn't been tested
+	uint64_t next = 0;
+	// number of candidates tested by this call to gws_crack()
+	uint64_t tested = 0;
+	double keys_per_sec = 0;
+
+	bool found = false;
+	uint64_t index = 0;
+	csp<bcm2dump::profile> profile;
+};
+
+// tries to find the password of the encrypted GatewaySettings file read
+// from `is`, starting with candidate `start`. if no profile is specified,
+// all profiles supporting passwords are tried. candidates are tested in
+// batches, using default_jobs() threads; `progress` is called after each
+// batch.
+crack_status gws_crack(std::istream& is, const csp<bcm2dump::profile>& p,
+		const password_source& source, uint64_t start,
+		const std::function<void(const crack_status&)>& progress);
 }
 
 #endif
@@ -20,6 +20,10 @@
 #include <sys/stat.h>
 #include <algorithm>
 #include <unistd.h>
+#include <fcntl.h>
+#include <fstream>
+#include <cstring>
+#include <cerrno>
 #include <set>
 #include "interface.h"
 #include "rwx.h"
@@ -28,6 +32,10 @@
 #include "snmp.h"
 #endif
 
+#ifdef _WIN32
+#include <io.h>
+#endif
+
 using namespace std;
 
 namespace bcm2dump {
@@ -79,21 +87,114 @@ bool is_char_device(const string& filename)
 	return !errno ? S_ISCHR(st.st_mode) : false;
 }
 
-uint32_t get_max_magic_addr(const profile::sp& p, int intf_id)
+// magic ranges that are at most this far apart are read at once
+constexpr uint32_t c_magic_gap_max = 1024;
+
+uint32_t magic_end(const bcm2_magic* m)
+{
+	return m->addr + magic_size(m);
+}
+
+// highest end address of all magics of the profile at table[i]
+uint32_t max_magic_end(const vector<profile_magic>& table, size_t i)
 {
 	uint32_t ret = 0;
 
-	for (auto v : p->versions()) {
-		if (v.intf() == intf_id) {
-			ret = max(ret, v.magic()->addr + magic_size(v.magic()) - 1);
+	for (auto p = table[i].p; i < table.size() && table[i].p == p; ++i) {
+		ret = max(ret, magic_end(table[i].m));
+	}
+
+	return ret;
+}
+
+// reads the memory required for checking magics in as few transfers
+// as possible.
+class magic_reader
+{
+	public:
+	magic_reader(const rwx::sp& ram) : m_ram(ram) {}
+
+	// reads all magics, starting at table[i], that lie below `limit`, and
+	// haven't been read yet. ranges are coalesced if the gap between them
+	// is small enough.
+	void prefetch(const vector<profile_magic>& table, size_t i, uint32_t limit)
+	{
+		vector<pair<uint32_t, uint32_t>> ranges;
+
+		for (; i < table.size(); ++i) {
+			auto m = table[i].m;
+			if (magic_end(m) <= limit && !find(m->addr, magic_size(m))) {
+				ranges.push_back({ m->addr, magic_end(m) });
+			}
+		}
+
+		sort(ranges.begin(), ranges.end());
+
+		for (size_t k = 0; k < ranges.size();) {
+			uint32_t beg = ranges[k].first;
+			uint32_t end = ranges[k].second;
+
+			for (++k; k < ranges.size() && ranges[k].first <= (end + c_magic_gap_max); ++k) {
+				end = max(end, ranges[k].second);
+			}
+
+			LOG_D() << "reading magics at 0x" << to_hex(beg) << "-0x" << to_hex(end - 1) << endl;
+			m_chunks.push_back({ beg, m_ram->read(beg, end - beg) });
 		}
 	}
 
-	for (auto m : p->magics()) {
-		ret = max(ret, m->addr + magic_size(m) - 1);
+	bool matches(const bcm2_magic* m)
+	{
+		string data = magic_data(m);
+		const string* chunk = find(m->addr, data.size());
+
+		if (!chunk) {
+			// shouldn't happen, since all magics are prefetched
+			return m_ram->read(m->addr, data.size()) == data;
+		}
+
+		return !chunk->compare(m->addr - m_chunks[m_found].first, data.size(), data);
 	}
 
-	return ret;
+	private:
+	const string* find(uint32_t addr, uint32_t size)
+	{
+		for (m_found = 0; m_found < m_chunks.size(); ++m_found) {
+			auto& c = m_chunks[m_found];
+			if (addr >= c.first && (addr + size) <= (c.first + c.second.size())) {
+				return &c.second;
+			}
+		}
+
+		return nullptr;
+	}
+
+	rwx::sp m_ram;
+	vector<pair<uint32_t, string>> m_chunks;
+	size_t m_found = 0;
+};
+
+// returns the first entry of the magic table that matches the device's memory
+const profile_magic* find_magic(const vector<profile_magic>& table, const rwx::sp& ram)
+{
+	magic_reader reader(ram);
+
+	// try all magics in ascending order. this is to avoid crashing a device
+	// by trying an offset that is outside its valid range. the magics of
+	// a profile are only checked once all profiles with a lower maximum
+	// magic address have been ruled out, but all magics below that address
+	// are read in one go.
+	for (size_t i = 0; i < table.size(); ++i) {
+		if (i == 0 || table[i].p != table[i - 1].p) {
+			reader.prefetch(table, i, max_magic_end(table, i));
+		}
+
+		if (reader.matches(table[i].m)) {
+			return &table[i];
+		}
+	}
+
+	return nullptr;
 }
 
 set<string> get_all_su_passwords()
@@ -101,7 +202,7 @@ set<string> get_all_su_passwords()
 	set<string> ret;
 
 	for (auto p : profile::list()) {
-		for (auto v : p->versions()) {
+		for (const auto& v : p->versions()) {
 			if (v.has_opt("bfc:su_password")) {
 				ret.insert(v.get_opt_str("bfc:su_password"));
 			}
@@ -134,6 +235,12 @@ class bfc : public cmdline_interface
 	virtual bool is_privileged() const override
 	{ return m_privileged; }
 
+	virtual string privilege_state() const override
+	{ return m_su_password; }
+
+	virtual void privilege_state(const string& state) override
+	{ m_su_password = state; }
+
 	protected:
 	virtual bool check_privileged();
 	virtual void detect_profile() override;
@@ -145,6 +252,8 @@ class bfc : public cmdline_interface
 	void do_elevate_privileges();
 	bool m_privileged = false;
 	bool m_is_rg_prompt = false;
+	// the su password that worked last
+	string m_su_password;
 };
 
 bool bfc::is_ready(bool passive)
@@ -209,16 +318,26 @@ void bfc::do_elevate_privileges()
 		passwords = get_all_su_passwords();
 	}
 
-	for (auto pw : passwords) {
+	vector<string> candidates;
+
+	// try the password that worked last time first
+	if (passwords.erase(m_su_password)) {
+		candidates.push_back(m_su_password);
+	}
+
+	candidates.insert(candidates.end(), passwords.begin(), passwords.end());
+
+	for (auto pw : candidates) {
 		run("su", "Password:", true);
 		writeln(pw);
 		writeln();
 
 		if (check_privileged()) {
-			if (passwords.size() > 1) {
-				logger::v() << "su password is '" << pw << "'" << endl;
+			if (candidates.size() > 1) {
+				LOG_V() << "su password is '" << pw << "'" << endl;
 			}
 
+			m_su_password = pw;
 			return;
 		}
 	}
@@ -237,7 +356,7 @@ void bfc::do_elevate_privileges()
 			ram->space().check_offset(addr, "console_priv_flag");
 			ram->write(addr, "\x01"s);
 		} catch (const exception& e) {
-			logger::d() << "while writing to console thread instance: " << e.what() << endl;
+			LOG_D() << "while writing to console thread instance: " << e.what() << endl;
 		}
 
 		writeln();
@@ -280,7 +399,7 @@ void bfc::detect_profile()
 			try {
 				pssig = lexical_cast<uint16_t>(l.substr(pos + needle.size()), 16, false);
 			} catch (const exception& e) {
-				logger::d() << e.what() << endl;
+				LOG_D() << e.what() << endl;
 				// ignore
 			}
 		}
@@ -292,12 +411,7 @@ void bfc::detect_profile()
 		return;
 	}
 
-	for (auto p : profile::list()) {
-		if (p->pssig() == pssig) {
-			m_profile = p;
-			break;
-		}
-	}
+	m_profile = profile::get_by_pssig(pssig);
 }
 
 void bfc::initialize_impl()
@@ -474,7 +588,7 @@ bool bfc_telnet::login(const string& user, const string& pass)
 				writeln();
 				send_newline = false;
 			} else {
-				logger::d() << "telnet: no login prompt" << endl;
+				LOG_D() << "telnet: no login prompt" << endl;
 				return false;
 			}
 		}
@@ -491,7 +605,7 @@ bool bfc_telnet::login(const string& user, const string& pass)
 	}, 3000);
 
 	if (!have_prompt) {
-		logger::d() << "telnet: no password prompt" << endl;
+		LOG_D() << "telnet: no password prompt" << endl;
 		return false;
 	}
 
@@ -531,34 +645,67 @@ void bfc_telnet::elevate_privileges()
 	bfc::elevate_privileges();
 }
 
-sp<cmdline_interface> do_detect_interface(const io::sp &io)
+// interface types, in the order they are probed
+const vector<string> c_interface_types = { "bfc-telnet", "bootloader", "bfc" };
+
+sp<cmdline_interface> make_interface(const string& type)
 {
-	sp<cmdline_interface> intf = make_shared<bfc_telnet>();
-	if (intf->is_active(io)) {
-		return intf;
+	if (type == "bfc-telnet") {
+		return make_shared<bfc_telnet>();
+	} else if (type == "bootloader") {
+		return make_shared<bootloader>();
+	} else if (type == "bfc") {
+		return make_shared<bfc>();
 	}
 
-	intf = make_shared<bootloader>();
-	if (intf->is_active(io)) {
+	return nullptr;
+}
+
+string interface_type(const interface& intf)
+{
+	return intf.name() + (dynamic_cast<const telnet*>(&intf) ? "-telnet" : "");
+}
+
+sp<cmdline_interface> do_detect_interface(const io::sp &io, const string& hint)
+{
+	// probe the type that was detected last time first, since each
+	// failed probe has to wait for a timeout.
+	auto intf = make_interface(hint);
+	if (intf && intf->is_active(io)) {
 		return intf;
 	}
 
-	intf = make_shared<bfc>();
-	if (intf->is_active(io)) {
-		return intf;
+	for (auto type : c_interface_types) {
+		if (type != hint) {
+			intf = make_interface(type);
+			if (intf->is_active(io)) {
+				return intf;
+			}
+		}
 	}
 
 	throw runtime_error("interface auto-detection failed");
 }
 
-sp<cmdline_interface> detect_interface(const io::sp &io)
+sp<cmdline_interface> detect_interface(const io::sp &io, const string& hint = "")
 {
-	auto intf = do_detect_interface(io);
-	logger::d() << "detected interface: " << intf->name() << endl;
+	auto intf = do_detect_interface(io, hint);
+	LOG_D() << "detected interface: " << intf->name() << endl;
 	return intf;
 }
 
 
+void set_profile_from_magic(const interface::sp& intf, const profile_magic& h)
+{
+	version v = h.v;
+
+	if (v.name().empty()) {
+		v = h.p->default_version(intf->id());
+	}
+
+	intf->set_profile(h.p, v);
+}
+
 void detect_profile_from_magics(const interface::sp& intf, const profile::sp& profile)
 {
 	if (profile) {
@@ -569,77 +716,211 @@ void detect_profile_from_magics(const interface::sp& intf, const profile::sp& pr
 	}
 
 	rwx::sp ram = rwx::create(intf, "ram", true);
+	const profile_magic* h = find_magic(profile::magic_table(intf->id()), ram);
 
-	// sort all magic specifications, and try them in ascending order. this
-	// is to avoid crashing a device by trying an offset that is outside its
-	// valid range.
+	if (h) {
+		set_profile_from_magic(intf, *h);
+	}
+}
 
-	struct helper
-	{
-		const bcm2_magic* m;
-		const profile::sp p;
-		const version v;
-		const uint32_t x;
-	};
+// checks whether the profile of a previous connection still matches. to
+// keep the order in which magics are safe to probe, this only stops the
+// detection after the cached profile; a different device on the same
+// interface is never probed with magics beyond its own. devices that
+// don't have a magic for this interface cannot be verified.
+bool detect_profile_from_fingerprint(const interface::sp& intf, const interface::fingerprint& fp)
+{
+	auto& table = profile::magic_table(intf->id());
+	auto last = find_if(table.rbegin(), table.rend(), [&fp] (const profile_magic& h) {
+		return h.p->name() == fp.profile;
+	});
 
-	struct comp
-	{
-		bool operator()(const helper& a, const helper& b) const
-		{
-			if (a.p->name() == b.p->name()) {
-				if (a.v.name().empty() != b.v.name().empty()) {
-					return b.v.name().empty();
-				}
+	if (last == table.rend()) {
+		return false;
+	}
 
-				if (a.m->addr == b.m->addr) {
-					if (magic_size(a.m) == magic_size(b.m)) {
-						return a.v.name() < b.v.name();
-					}
+	vector<profile_magic> prefix(table.begin(), last.base());
+	const profile_magic* h = nullptr;
 
-					// try the longer magic value first
-					return magic_size(a.m) > magic_size(b.m);
-				}
+	try {
+		h = find_magic(prefix, rwx::create(intf, "ram", true));
+	} catch (const exception& e) {
+		LOG_D() << "while verifying cached profile: " << e.what() << endl;
+	}
 
-				return a.m->addr < b.m->addr;
-			}
+	if (!h || h->p->name() != fp.profile) {
+		LOG_D() << "device no longer matches cached profile " << fp.profile << endl;
+		return false;
+	}
+
+	set_profile_from_magic(intf, *h);
+	return true;
+}
 
-			return a.x < b.x;
+// the device cache maps an interface spec (without passwords) to the
+// fingerprint of the device that was found there. it's a text file, with
+// tab-separated fields, and one device per line. tabs, newlines and
+// backslashes within fields are escaped.
+string g_cache_file = [] () -> string {
+	for (auto var : { "BCM2DUMP_CACHE", "XDG_CACHE_HOME", "HOME", "LOCALAPPDATA" }) {
+		const char* dir = getenv(var);
+		if (!dir || !*dir) {
+			continue;
+		} else if (var == "BCM2DUMP_CACHE"s) {
+			return dir;
+		} else if (var == "HOME"s) {
+			return dir + "/.cache/bcm2dump.cache"s;
+		} else {
+			return dir + "/bcm2dump.cache"s;
 		}
-	};
+	}
 
-	set<helper, comp> magics;
+	return "";
+}();
 
-	for (auto p : profile::list()) {
-		if (profile && profile->name() != p->name()) {
-			continue;
+string cache_escape(const string& str)
+{
+	string ret;
+
+	for (char c : str) {
+		if (c == '\\') {
+			ret += "\\\\";
+		} else if (c == '\t') {
+			ret += "\\t";
+		} else if (c == '\n') {
+			ret += "\\n";
+		} else if (c == '\r') {
+			ret += "\\r";
+		} else {
+			ret += c;
 		}
+	}
 
-		uint32_t x = get_max_magic_addr(p, intf->id());
+	return ret;
+}
 
-		for (auto v : p->versions()) {
-			if (v.intf() == intf->id()) {
-				magics.insert({ v.magic(), p, v, x });
-			}
+string cache_unescape(const string& str)
+{
+	string ret;
+
+	for (size_t i = 0; i < str.size(); ++i) {
+		if (str[i] != '\\' || (i + 1) == str.size()) {
+			ret += str[i];
+			continue;
 		}
 
-		for (auto m : p->magics()) {
-			magics.insert({ m, p, version(), x });
+		switch (str[++i]) {
+		case 't':
+			ret += '\t';
+			break;
+		case 'n':
+			ret += '\n';
+			break;
+		case 'r':
+			ret += '\r';
+			break;
+		default:
+			ret += str[i];
 		}
 	}
 
-	for (const helper& h : magics) {
-		string data = magic_data(h.m);
-		if (ram->read(h.m->addr, data.size()) == data) {
-			version v = h.v;
+	return ret;
+}
 
-			if (v.name().empty()) {
-				v = h.p->default_version(intf->id());
-			}
+map<string, interface::fingerprint> read_device_cache()
+{
+	map<string, interface::fingerprint> ret;
+	ifstream in(g_cache_file);
+	string line;
+
+	while (getline(in, line)) {
+		// not using split(), since its escape rules differ from ours
+		vector<string> f;
+		string::size_type beg = 0, end;
+
+		do {
+			end = line.find('\t', beg);
+			f.push_back(cache_unescape(line.substr(beg, end - beg)));
+			beg = end + 1;
+		} while (end != string::npos);
+
+		if (f.size() == 5) {
+			ret[f[0]] = { f[1], f[2], f[3], f[4] };
+		}
+	}
 
-			intf->set_profile(h.p, v);
-			return;
+	return ret;
+}
+
+bool get_fingerprint(const string& key, interface::fingerprint& fp)
+{
+	if (key.empty() || g_cache_file.empty()) {
+		return false;
+	}
+
+	auto cache = read_device_cache();
+	auto it = cache.find(key);
+	if (it == cache.end()) {
+		return false;
+	}
+
+	fp = it->second;
+	LOG_D() << "cached fingerprint for " << key << ": " << fp.type << ", "
+			<< fp.profile << ", " << fp.version << endl;
+	return true;
+}
+
+// creates a new temporary file next to the cache file, without following
+// any existing file or symlink.
+void put_fingerprint(const string& key, const interface::fingerprint& fp)
+{
+	if (key.empty() || g_cache_file.empty()) {
+		return;
+	}
+
+	auto cache = read_device_cache();
+	cache[key] = fp;
+
+	string data;
+
+	for (auto& e : cache) {
+		auto& f = e.second;
+		for (auto field : { e.first, f.type, f.profile, f.version }) {
+			data += cache_escape(field) + '\t';
 		}
+
+		data += cache_escape(f.privileges) + '\n';
 	}
+
+	auto pos = g_cache_file.find_last_of("/\\");
+	if (pos != string::npos && pos) {
+		string dir = g_cache_file.substr(0, pos);
+#ifndef _WIN32
+		mkdir(dir.c_str(), 0700);
+#else
+		mkdir(dir.c_str());
+#endif
+	}
+
+	// write to a temporary file first, so that concurrent processes never
+	// see a partially written cache.
+	if (!write_file_atomic(g_cache_file, data)) {
+		logger::w() << "failed to write " << g_cache_file << ": " << strerror(errno) << endl;
+	}
+}
+
+// returns a cache key for an interface spec, excluding any passwords
+string get_cache_key(const string& type, const vector<string>& tokens)
+{
+	if (type == "serial" && !tokens.empty()) {
+		return type + ":" + tokens[0];
+	} else if (type == "tcp" && tokens.size() == 2) {
+		return type + ":" + tokens[0] + "," + tokens[1];
+	} else if (type == "telnet" && tokens.size() >= 3) {
+		return type + ":" + tokens[0] + "," + tokens[1] + "," + (tokens.size() == 4 ? tokens[3] : "23");
+	}
+
+	return "";
 }
 }
 
@@ -754,10 +1035,18 @@ string cmdline_interface::readln(unsigned timeout) const
 	return line;
 }
 
-void interface::initialize(const profile::sp& profile)
+void interface::initialize(const profile::sp& profile, const fingerprint* fp)
 {
 	m_profile = profile;
 
+	if (fp) {
+		privilege_state(fp->privileges);
+
+		if (!m_profile && detect_profile_from_fingerprint(shared_from_this(), *fp)) {
+			LOG_V() << "using cached profile " << m_profile->name() << endl;
+		}
+	}
+
 	if (!m_profile) {
 		detect_profile_from_magics(shared_from_this(), m_profile);
 	}
@@ -790,6 +1079,11 @@ interface::sp interface::detect(const io::sp& io, const profile::sp& profile)
 	return intf;
 }
 
+void interface::set_cache_file(const string& filename)
+{
+	g_cache_file = filename;
+}
+
 interface::sp interface::create(const string& spec, const string& profile_name)
 {
 	profile::sp profile;
@@ -819,14 +1113,19 @@ interface::sp interface::create(const string& spec, const string& profile_name)
 	}
 
 	try {
+		string key = get_cache_key(type, tokens);
+		fingerprint fp;
+		bool cached = get_fingerprint(key, fp);
+		shared_ptr<cmdline_interface> intf;
+
 		if (type == "serial") {
 			unsigned speed = tokens.size() == 2 ? lexical_cast<unsigned>(tokens[1]) : 115200;
-			return detect(io::open_serial(tokens[0].c_str(), speed), profile);
+			intf = detect_interface(io::open_serial(tokens[0].c_str(), speed), fp.type);
 		} else if (type == "tcp") {
-			return detect(io::open_tcp(tokens[0], lexical_cast<uint16_t>(tokens[1])), profile);
+			intf = detect_interface(io::open_tcp(tokens[0], lexical_cast<uint16_t>(tokens[1])), fp.type);
 		} else if (type == "telnet") {
 			uint16_t port = tokens.size() == 4 ? lexical_cast<uint16_t>(tokens[3]) : 23;
-			interface::sp intf = detect_interface(io::open_telnet(tokens[0], port));
+			intf = detect_interface(io::open_telnet(tokens[0], port), fp.type);
 
 			// this is UGLY, but it should never fail
 			telnet* t = dynamic_cast<telnet*>(intf.get());
@@ -837,8 +1136,28 @@ interface::sp interface::create(const string& spec, const string& profile_name)
 			} else {
 				logger::w() << "detected non-telnet interface" << endl;
 			}
+		}
+
+		if (intf) {
+			// the fingerprint is only valid for the same interface type
+			cached &= (fp.type == interface_type(*intf));
+			intf->initialize(profile, cached ? &fp : nullptr);
+
+			// a forced profile would skip detection on the next run
+			if (!profile && intf->profile()) {
+				fingerprint current = {
+					interface_type(*intf),
+					intf->profile()->name(),
+					intf->version().name(),
+					intf->privilege_state()
+				};
+
+				if (!cached || current.profile != fp.profile || current.version != fp.version
+						|| current.privileges != fp.privileges) {
+					put_fingerprint(key, current);
+				}
+			}
 
-			intf->initialize(profile);
 			return intf;
 		} else if (type == "snmp") {
 #ifdef BCM2DUMP_WITH_SNMP
@@ -67,13 +67,32 @@ class interface : public std::enable_shared_from_this<interface>
 
 	virtual void elevate_privileges() {}
 
+	// opaque privilege state, stored in the device cache, that allows
+	// elevating privileges faster on subsequent connections.
+	virtual std::string privilege_state() const
+	{ return ""; }
+
+	virtual void privilege_state(const std::string& state) {}
+
 	static interface::sp detect(const io::sp& io, const profile::sp& sp = nullptr);
 	static interface::sp create(const std::string& specl, const std::string& profile = "");
 
+	// sets the device cache file; an empty filename disables the cache
+	static void set_cache_file(const std::string& filename);
+
 	virtual bcm2_interface id() const = 0;
 
+	// what is known about a device from a previous connection
+	struct fingerprint
+	{
+		std::string type;
+		std::string profile;
+		std::string version;
+		std::string privileges;
+	};
+
 	protected:
-	void initialize(const profile::sp& profile);
+	void initialize(const profile::sp& profile, const fingerprint* fp = nullptr);
 
 	virtual void initialize_impl()
 	{}
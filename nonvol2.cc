@@ -19,7 +19,12 @@
 
 #include <iostream>
 #include <string>
-#include <set>
+#include <typeindex>
+#include <typeinfo>
+#include <atomic>
+#include <mutex>
+#include <tuple>
+#include <unordered_map>
 #include "nonvol2.h"
 #include "util.h"
 using namespace std;
@@ -67,16 +72,16 @@ bool read_group_header(istream& is, nv_u16& size, nv_magic& magic, size_t remain
 {
 	if (size.read(is)) {
 		if (size.num() < 6) {
-			logger::v() << "group size " << size.to_str() << " too small to be valid" << endl;
+			LOG_V() << "group size " << size.to_str() << " too small to be valid" << endl;
 			return false;
 		} else if (!magic.read(is)) {
-			logger::v() << "failed to read group magic" << endl;
+			LOG_V() << "failed to read group magic" << endl;
 			return false;
 		}
 
 		return true;
 	} else {
-		logger::v() << "failed to read group size" << endl;
+		LOG_V() << "failed to read group size" << endl;
 	}
 
 	return false;
@@ -250,6 +255,32 @@ void nv_val::set(const string& name, const string& val)
 	throw runtime_error("requested member '" + name + "' of non-compound type " + type());
 }
 
+thread_local nv_arena* nv_arena::s_current = nullptr;
+
+void* nv_arena::allocate(size_t size, size_t alignment)
+{
+	size_t pad = (alignment - (reinterpret_cast<uintptr_t>(m_pos) % alignment)) % alignment;
+
+	if (m_avail < size + pad) {
+		if (size > block_size / 4) {
+			// large allocations get their own block, so we don't waste the current one
+			m_blocks.emplace_back(new char[size + alignment]);
+			char* p = m_blocks.back().get();
+			return p + (alignment - (reinterpret_cast<uintptr_t>(p) % alignment)) % alignment;
+		}
+
+		m_blocks.emplace_back(new char[block_size]);
+		m_pos = m_blocks.back().get();
+		m_avail = block_size;
+		pad = (alignment - (reinterpret_cast<uintptr_t>(m_pos) % alignment)) % alignment;
+	}
+
+	void* ret = m_pos + pad;
+	m_pos += size + pad;
+	m_avail -= size + pad;
+	return ret;
+}
+
 nv_val& nv_val::parse_checked(const std::string& str)
 {
 	if (!parse(str)) {
@@ -276,20 +307,51 @@ csp<nv_val> nv_compound::get(const string& name) const
 
 void nv_compound::set(const string& name, const string& val)
 {
-	auto parts = split(name, '.', false, 2);
-	if (parts.size() == 2) {
-#if 1
-		auto v = const_pointer_cast<nv_val>(get(parts[0]));
-		size_t oldsize = v->bytes();
-		v->set(parts[1], val);
-		m_bytes -= (oldsize - v->bytes());
-#else
-		const_pointer_cast<nv_val>(get(parts[0]))->set(parts[1], val);
-#endif
+	nv_path path(name);
+
+	if (path.size() > 1) {
+		// walk down to the compound containing the leaf, remembering the
+		// size of each level, so their byte counts can be adjusted later.
+		vector<pair<nv_compound*, size_t>> levels;
+		nv_compound* c = this;
+		sp<nv_val> v;
+		size_t i = 0;
+
+		for (; i < path.size() - 1; ++i) {
+			v = const_pointer_cast<nv_val>(c->find_member(path[i]));
+			if (!v) {
+				throw invalid_argument("requested non-existing member '" + path[i] + "'");
+			} else if (!v->is_compound()) {
+				break;
+			}
+
+			levels.push_back({ c, v->bytes() });
+			c = static_cast<nv_compound*>(v.get());
+		}
+
+		if (i == path.size() - 1) {
+			c->set(path[i], val);
+		} else {
+			// a non-compound type with members of its own (e.g. nv_data)
+			string rest = path[++i];
+			while (++i < path.size()) {
+				rest += "." + path[i];
+			}
+
+			size_t oldsize = v->bytes();
+			v->set(rest, val);
+			c->m_bytes -= (oldsize - v->bytes());
+		}
+
+		for (auto it = levels.rbegin(); it != levels.rend(); ++it) {
+			it->first->m_bytes -= (it->second - c->bytes());
+			c = it->first;
+		}
+
 		return;
 	}
 
-	sp<nv_val> v = const_pointer_cast<nv_val>(get(name));
+	sp<nv_val> v = const_pointer_cast<nv_val>(get(path));
 	if (!v->is_set()) {
 		const nv_compound* parent = v->parent();
 		while (parent && !parent->is_set()) {
@@ -319,23 +381,73 @@ void nv_compound::set(const string& name, const string& val)
 	m_bytes -= (oldsize - v->bytes());
 }
 
+struct nv_compound::layout
+{
+	vector<string> names;
+	vector<bool> unnamed;
+	unordered_map<string, size_t> index;
+};
+
+csp<nv_val> nv_compound::get(const nv_path& path) const
+{
+	auto val = find(path);
+	if (!val) {
+		throw invalid_argument("requested non-existing member '" + path.str() + "'");
+	}
+
+	return val;
+}
+
 csp<nv_val> nv_compound::find(const string& name) const
 {
-	vector<string> tok = split(name, '.', false, 2);
+	return find(nv_path(name));
+}
 
-	for (auto c : parts()) {
-		if (c.val->is_disabled()) {
-			continue;
-		} else if (c.name == tok[0]) {
-			if (tok.size() == 2) {
-				if (c.val->is_compound()) {
-					return nv_val_cast<nv_compound>(c.val)->find(tok[1]);
-				} else {
-					break;
-				}
-			} else {
-				return c.val;
+csp<nv_val> nv_compound::find(const nv_path& path) const
+{
+	csp<nv_val> val;
+	const nv_compound* c = this;
+
+	for (size_t i = 0; i < path.size(); ++i) {
+		if (i) {
+			if (!val->is_compound()) {
+				return nullptr;
+			}
+
+			c = static_cast<const nv_compound*>(val.get());
+		}
+
+		val = c->find_member(path[i]);
+		if (!val) {
+			break;
+		}
+	}
+
+	return val;
+}
+
+csp<nv_val> nv_compound::find_member(const string& name) const
+{
+	const list& parts = this->parts();
+	size_t i = 0;
+
+	if (m_layout && m_layout->names.size() <= parts.size()) {
+		auto it = m_layout->index.find(name);
+		if (it == m_layout->index.end()) {
+			// members added after reading (_extra, list elements) aren't indexed
+			i = m_layout->names.size();
+		} else if (parts[it->second].name == name) {
+			if (!parts[it->second].val->is_disabled()) {
+				return parts[it->second].val;
 			}
+
+			i = m_layout->names.size();
+		}
+	}
+
+	for (; i < parts.size(); ++i) {
+		if (!parts[i].val->is_disabled() && parts[i].name == name) {
+			return parts[i].val;
 		}
 	}
 
@@ -346,6 +458,7 @@ bool nv_compound::init(bool force)
 {
 	if (m_parts.empty() || force) {
 		m_parts = definition();
+		m_layout.reset();
 		for (auto part : m_parts) {
 			part.val->parent(this);
 		}
@@ -357,34 +470,93 @@ bool nv_compound::init(bool force)
 	return false;
 }
 
-istream& nv_compound::read(istream& is)
+void nv_compound::check_layout()
 {
-	clear();
+	typedef pair<type_index, uint64_t> key_type;
+
+	struct key_hash
+	{
+		size_t operator()(const key_type& k) const
+		{ return k.first.hash_code() ^ hash<uint64_t>()(k.second); }
+	};
+
+	typedef unordered_map<key_type, csp<layout>, key_hash> map_type;
+
+	// layouts are immutable once published. each thread keeps its own
+	// copy of the lookup table, so the shared one is only locked on a miss.
+	static map_type layouts;
+	static mutex lock;
+	thread_local map_type cached;
+
+	key_type key(typeid(*this), layout_variant());
+	csp<layout> l;
+
+	auto it = cached.find(key);
+	if (it != cached.end()) {
+		l = it->second;
+	} else {
+		lock_guard<mutex> guard(lock);
+		auto it = layouts.find(key);
+		if (it != layouts.end()) {
+			l = cached[key] = it->second;
+		}
+	}
+
+	if (l && l->names.size() == m_parts.size()) {
+		for (size_t i = 0; i < m_parts.size(); ++i) {
+			if (l->unnamed[i]) {
+				m_parts[i].name = l->names[i];
+			}
+		}
 
-	std::set<string> names;
+		m_layout = l;
+		return;
+	}
+
+	auto nl = make_shared<layout>();
 	unsigned unk = 0;
 
-	// do this for all parts, regardless of whether they
-	// are found in the config file
 	for (auto& v : m_parts) {
+		nl->unnamed.push_back(v.name.empty());
+
 		if (v.name.empty()) {
 			v.name = "_unk_" + std::to_string(++unk);
 		}
-	}
 
-	for (auto& v : m_parts) {
-		if (!names.insert(v.name).second) {
+		if (!nl->index.emplace(v.name, nl->names.size()).second) {
 			throw runtime_error("redefinition of member " + v.name);
 		} else if (!is_valid_identifier(v.name)) {
 			throw runtime_error("invalid identifier name " + v.name);
-		} else if (v.val->is_disabled()) {
-			logger::t() << "skipping disabled " << desc(v) << endl;
+		}
+
+		nl->names.push_back(v.name);
+	}
+
+	m_layout = nl;
+
+	// a type that doesn't honor the layout_variant() contract still
+	// works, it just doesn't benefit from the cache.
+	if (!l) {
+		lock_guard<mutex> guard(lock);
+		layouts.emplace(key, nl);
+		cached[key] = layouts[key];
+	}
+}
+
+istream& nv_compound::read(istream& is)
+{
+	clear();
+	check_layout();
+
+	for (auto& v : m_parts) {
+		if (v.val->is_disabled()) {
+			LOG_T() << "skipping disabled " << desc(v) << endl;
 			continue;
 		}
 
 		bool end = false;
 
-		logger::t() << "pos " << is.tellg() << ": " << desc(v) << " " << v.val->bytes() << endl;
+		LOG_T() << "pos " << is.tellg() << ": " << desc(v) << " " << v.val->bytes() << endl;
 
 		if ((m_width && (m_bytes + v.val->bytes()) > m_width)) {
 			throw runtime_error(v.name + ": variable size exceeds compound size");
@@ -394,7 +566,7 @@ istream& nv_compound::read(istream& is)
 
 		if (!end) {
 			v.val->read(is);
-			logger::t() << " = " << v.val->to_string(0, false) << endl;
+			LOG_T() << " = " << v.val->to_string(0, false) << endl;
 		}
 
 		if (!is) {
@@ -402,7 +574,7 @@ istream& nv_compound::read(istream& is)
 				throw runtime_error(type() + ": read error");
 			}
 
-			logger::t() << "  encountered eof while reading" << endl;
+			LOG_T() << "  encountered eof while reading" << endl;
 			end = true;
 		}
 
@@ -450,23 +622,23 @@ ostream& nv_compound::write(ostream& os) const
 	size_t pos = 0;
 
 	for (auto v : parts()) {
-		logger::t() << "pos " << pos << ": ";
+		LOG_T() << "pos " << pos << ": ";
 		if (v.val->is_disabled()) {
-			logger::t() << v.name << " (disabled)" << endl;
+			LOG_T() << v.name << " (disabled)" << endl;
 			continue;
 		} else if (!v.val->is_set()) {
 			if (m_partial) {
-				logger::t() << v.name << " (unset)" << endl;
+				LOG_T() << v.name << " (unset)" << endl;
 				continue;
 			}
-			logger::t() << "writing unset " << name() << "." << v.name << endl;
+			LOG_T() << "writing unset " << name() << "." << v.name << endl;
 		}
 
 		if (!v.val->write(os)) {
 			throw runtime_error("failed to write " + desc(v));
 		}
 
-		logger::t() << desc(v) << endl;
+		LOG_T() << desc(v) << endl;
 		pos += v.val->bytes();
 	}
 
@@ -502,7 +674,7 @@ string nv_data::to_string(unsigned level, bool pretty) const
 
 csp<nv_val> nv_data::get(const string& name) const
 {
-	return make_shared<nv_u8>(m_buf[to_index(name, *this)]);
+	return nv_make<nv_u8>(m_buf[to_index(name, *this)]);
 }
 
 void nv_data::set(const string& name, const string& val)
@@ -760,9 +932,11 @@ istream& nv_group::read(istream& is)
 		throw runtime_error("failed to read group version");
 	}
 
-	logger::t() << "** " << m_magic.to_str() << " " << m_magic.to_pretty() << " " << m_size.num() << " b, version 0x" << to_hex(m_version.num()) << endl;
+	LOG_T() << "** " << m_magic.to_str() << " " << m_magic.to_pretty() << " " << m_size.num() << " b, version 0x" << to_hex(m_version.num()) << endl;
 
 	auto pos = is.tellg();
+	size_t header = is_versioned() ? 8 : 6;
+
 	try {
 		nv_compound::read(is);
 	} catch (const exception& e) {
@@ -773,7 +947,7 @@ istream& nv_group::read(istream& is)
 		// groups under this size are empty
 		if (m_size.num() > 6 + (is_versioned() ? 2 : 0)) {
 			logger::w() << "failed to parse group " << name() << endl;
-			logger::d() << e.what() << endl;
+			LOG_D() << e.what() << endl;
 		}
 
 		m_format = fmt_unknown;
@@ -781,40 +955,37 @@ istream& nv_group::read(istream& is)
 		is.clear();
 		is.seekg(pos);
 
-		return nv_compound::read(is);
+		nv_compound::read(is);
 	}
 
-	if (is) {
-		//m_bytes += is_versioned() ? 8 : 6;
+	if (is.bad()) {
+		throw runtime_error(type() + ": read error");
+	} else if (!is) {
+		// the data ended before the group's definition did, so continue
+		// after the last complete member.
+		is.clear();
+		is.seekg(pos + streamoff(m_bytes - header));
+	}
 
-		if (m_bytes < m_size.num()) {
-			sp<nv_val> extra = make_shared<nv_data>(m_size.num() - m_bytes);
-			if (!extra->read(is)) {
-				throw runtime_error("failed to read remaining " + std::to_string(extra->bytes()) + " bytes");
-			}
+	// the stream contains this group's data only (see decode()), so
+	// anything that's left is kept as extra data.
+	string rest(istreambuf_iterator<char>(is), {});
 
-			logger::t() << "  extra data size is " << extra->bytes() << "b" << endl;
-			m_parts.push_back(named("_extra", extra));
-			logger::t() << extra->to_pretty() << endl;
-			m_bytes += extra->bytes();
-		}
-	} else {
-		if (is.bad()) {
-			throw runtime_error(type() + ": read error");
-		}
+	if (!rest.empty()) {
+		sp<nv_val> extra = nv_make<nv_data>(rest.size());
+		imemstream istr(rest);
+		extra->read(istr);
 
-		m_size.num(m_bytes);
-		logger::t() << "  truncating group size to " << m_bytes << endl;
-
-		// nv_compound::read() may have set failbit
-		is.clear(is.rdstate() & ~ios::failbit);
+		LOG_T() << "  extra data size is " << extra->bytes() << "b" << endl;
+		m_parts.push_back(named("_extra", extra));
+		LOG_T() << extra->to_pretty() << endl;
+		m_bytes += extra->bytes();
 	}
 
-#if 0
 	if (m_bytes != m_size.num()) {
-		throw runtime_error("group has trailing data: " + std::to_string(m_bytes) + " / " + m_size.to_string(false));
+		LOG_T() << "  adjusting group size to " << m_bytes << endl;
+		m_size.num(m_bytes);
 	}
-#endif
 
 	return is;
 }
@@ -825,6 +996,14 @@ ostream& nv_group::write(ostream& os) const
 		throw runtime_error(type() + ": size " + ::to_string(m_bytes) + " exceeds maximum");
 	}
 
+	if (m_lazy) {
+		if (!nv_u16::write(os, m_bytes) || !m_magic.write(os) || !os.write(m_raw.data(), m_raw.size())) {
+			throw runtime_error(type() + ": error while writing group");
+		}
+
+		return os;
+	}
+
 	if (!nv_u16::write(os, m_bytes) || !m_magic.write(os) || (is_versioned() && !m_version.write(os))) {
 		throw runtime_error(type() + ": error while writing group header");
 		return os;
@@ -837,6 +1016,40 @@ ostream& nv_group::write(ostream& os) const
 	return os;
 }
 
+const nv_val::list& nv_group::parts() const
+{
+	decode();
+	return nv_compound::parts();
+}
+
+void nv_group::decode(const string& raw)
+{
+	imemstream istr(raw);
+	read(istr);
+}
+
+void nv_group::decode() const
+{
+	if (!m_lazy) {
+		return;
+	}
+
+	// reset the state first, so a failed parse isn't retried on every access
+	string raw;
+	raw.swap(m_raw);
+	m_lazy = false;
+
+	nv_arena::scope scope(m_lazy_arena);
+	m_lazy_arena = nullptr;
+
+	const_cast<nv_group*>(this)->decode(raw);
+}
+
+uint64_t nv_group::layout_variant() const
+{
+	return uint64_t(m_format) << 48 | uint64_t(m_version.num()) << 32 | extract<uint32_t>(m_magic.raw());
+}
+
 nv_val::list nv_group::definition() const
 {
 	if (!m_format) {
@@ -850,25 +1063,108 @@ nv_val::list nv_group::definition(int format, const nv_version& ver) const
 {
 	uint16_t size = m_size.num() - (is_versioned() ? 8 : 6);
 	if (size) {
-		return {{ "_data", std::make_shared<nv_data>(size) }};
+		return {{ "_data", nv_make<nv_data>(size) }};
 	}
 
 	return {};
 }
 
-void nv_group::registry_add(const csp<nv_group>& group)
+namespace {
+// maps magics to group prototypes, using a perfect hash table. groups are
+// only added during initialization; the table is built lazily on the first
+// lookup, after which lookups are always a single probe.
+class nv_group_registry
 {
-	registry()[group->m_magic] = group;
-}
+	public:
+	void add(const csp<nv_group>& group)
+	{
+		lock_guard<mutex> lock(m_lock);
+		m_groups[key(group->magic())] = group;
+		m_dirty = true;
+	}
+
+	const nv_group* find(const nv_magic& magic)
+	{
+		if (m_dirty) {
+			lock_guard<mutex> lock(m_lock);
+			if (m_dirty) {
+				rebuild();
+				m_dirty = false;
+			}
+		}
+
+		uint32_t k = key(magic);
+		auto& e = m_table[(k * m_mult) >> m_shift];
+		return (e.second && e.first == k) ? e.second.get() : nullptr;
+	}
+
+	private:
+	typedef pair<uint32_t, csp<nv_group>> entry;
+
+	static uint32_t key(const nv_magic& magic)
+	{ return extract<uint32_t>(magic.raw()); }
+
+	void rebuild()
+	{
+		// with a load factor of at most 1/4, a suitable multiplier is
+		// usually found within a few dozen attempts.
+		for (unsigned bits = 1; bits < 32; ++bits) {
+			if ((size_t(1) << bits) < 4 * m_groups.size()) {
+				continue;
+			}
+
+			uint32_t mult = 0x9e3779b1;
+			for (unsigned i = 0; i < 1024; ++i, mult += 0x6a09e668) {
+				if (try_build(bits, mult)) {
+					return;
+				}
+			}
+		}
+
+		throw runtime_error("failed to build group registry");
+	}
+
+	bool try_build(unsigned bits, uint32_t mult)
+	{
+		vector<entry> table(size_t(1) << bits);
+
+		for (auto& g : m_groups) {
+			auto& e = table[(g.first * mult) >> (32 - bits)];
+			if (e.second) {
+				return false;
+			}
 
-map<nv_magic, csp<nv_group>>& nv_group::registry()
+			e = g;
+		}
+
+		m_table.swap(table);
+		m_mult = mult;
+		m_shift = 32 - bits;
+		return true;
+	}
+
+	mutex m_lock;
+	atomic<bool> m_dirty { false };
+	map<uint32_t, csp<nv_group>> m_groups;
+	vector<entry> m_table = vector<entry>(1);
+	uint32_t m_mult = 0;
+	unsigned m_shift = 31;
+};
+
+nv_group_registry& registry()
 {
-	static map<nv_magic, csp<nv_group>> ret;
+	static nv_group_registry ret;
 	return ret;
 }
+}
+
+void nv_group::registry_add(const csp<nv_group>& group)
+{
+	registry().add(group);
+}
 
 istream& nv_group::read(istream& is, sp<nv_group>& group, int format,
-		size_t remaining, const csp<bcm2dump::profile>& p)
+		size_t remaining, const csp<bcm2dump::profile>& p, bool lazy)
 {
 	nv_u16 size;
 	nv_magic magic;
@@ -877,16 +1173,16 @@ istream& nv_group::read(istream& is, sp<nv_group>& group, int format,
 		group = nullptr;
 		return is;
 	} else if (size.num() > remaining) {
-		logger::d() << "group size " << size.to_str() << " exceeds maximum size " << remaining << endl;
+		LOG_D() << "group size " << size.to_str() << " exceeds maximum size " << remaining << endl;
 		size.num(remaining);
 	}
 
-	auto i = registry().find(magic);
-	if (i == registry().end()) {
+	auto proto = registry().find(magic);
+	if (!proto) {
 		string name = transform(magic_to_string(magic.raw(), true, 0), ::tolower);
-		group = make_shared<nv_group_generic>(magic, "grp_" + name);
+		group = nv_make<nv_group_generic>(magic, "grp_" + name);
 	} else {
-		group.reset(i->second->clone());
+		group.reset(proto->clone());
 	}
 
 	group->m_size = size;
@@ -894,7 +1190,33 @@ istream& nv_group::read(istream& is, sp<nv_group>& group, int format,
 	group->m_format = format;
 	group->m_profile = p;
 
-	return group->read(is);
+	string raw(size.num() - 6, '\0');
+	is.read(&raw[0], raw.size());
+
+	if (size_t(is.gcount()) < raw.size()) {
+		// truncated group; parse what's there
+		raw.resize(is.gcount());
+		is.clear(is.rdstate() & ~ios::failbit);
+	} else if (lazy && raw.size() >= (group->is_versioned() ? 2 : 0)) {
+		// the group's version is needed without decoding the group, so
+		// it's parsed right away, but kept in the raw data as well.
+		if (group->is_versioned()) {
+			imemstream istr(raw);
+			group->m_version.read(istr);
+		}
+
+		LOG_T() << "** " << magic.to_str() << " " << magic.to_pretty() << " " << size.num() << " b (deferred)" << endl;
+
+		group->m_raw.swap(raw);
+		group->m_lazy = true;
+		group->m_lazy_arena = nv_arena::current();
+		group->m_bytes = size.num();
+		group->m_set = true;
+		return is;
+	}
+
+	group->decode(raw);
+	return is;
 }
 
 }
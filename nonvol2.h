@@ -64,6 +64,91 @@ template<class T> struct nv_type
 
 template<class To, class From, class ToType> sp<To> nv_val_cast(const From& from);
 
+// an arena for the nv_val objects of a parsed file. memory is allocated
+// in large blocks, and freed all at once when the arena is destroyed.
+// allocations don't keep their arena alive, so the arena's owner (usually
+// a settings object) must outlive all objects allocated from it. values
+// that are needed after that must be copied.
+//
+// new objects are allocated from the arena that is active on the current
+// thread (see nv_arena::scope), or using operator new if there is none.
+class nv_arena
+{
+	public:
+	static constexpr size_t block_size = 64 * 1024;
+
+	class scope
+	{
+		public:
+		scope(nv_arena* arena) : m_prev(s_current)
+		{ s_current = arena; }
+
+		~scope()
+		{ s_current = m_prev; }
+
+		private:
+		nv_arena* m_prev;
+	};
+
+	nv_arena() = default;
+	nv_arena(const nv_arena&) = delete;
+	nv_arena& operator=(const nv_arena&) = delete;
+
+	void* allocate(size_t size, size_t alignment);
+
+	static nv_arena* current()
+	{ return s_current; }
+
+	private:
+	static thread_local nv_arena* s_current;
+
+	std::vector<std::unique_ptr<char[]>> m_blocks;
+	char* m_pos = nullptr;
+	size_t m_avail = 0;
+};
+
+template<class T> class nv_arena_allocator
+{
+	template<class U> friend class nv_arena_allocator;
+
+	public:
+	typedef T value_type;
+
+	nv_arena_allocator(nv_arena* arena) : m_arena(arena) {}
+
+	template<class U> nv_arena_allocator(const nv_arena_allocator<U>& other)
+	: m_arena(other.m_arena) {}
+
+	T* allocate(size_t n)
+	{
+		size_t size = n * sizeof(T);
+		return static_cast<T*>(m_arena ? m_arena->allocate(size, alignof(T)) : ::operator new(size));
+	}
+
+	void deallocate(T* p, size_t)
+	{
+		if (!m_arena) {
+			::operator delete(p);
+		}
+	}
+
+	template<class U> bool operator==(const nv_arena_allocator<U>& other) const
+	{ return m_arena == other.m_arena; }
+
+	template<class U> bool operator!=(const nv_arena_allocator<U>& other) const
+	{ return !(*this == other); }
+
+	private:
+	nv_arena* m_arena;
+};
+
+// like std::make_shared, but allocates from the current arena
+template<class T, class... Args> sp<T> nv_make(Args&&... args)
+{
+	return std::allocate_shared<T>(nv_arena_allocator<T>(nv_arena::current()),
+			std::forward<Args>(args)...);
+}
+
 class nv_compound;
 
 class nv_val : public serializable
@@ -147,6 +232,28 @@ template<class To, class From, class ToType = nv_type<To>> std::shared_ptr<To> n
 	return p;
 }
 
+// a dot-separated path to a compound member (e.g. "userif.users.0"),
+// split into its elements once, so it can be used for multiple lookups
+class nv_path
+{
+	public:
+	explicit nv_path(const std::string& path)
+	: m_str(path), m_elems(bcm2dump::split(path, '.', false)) {}
+
+	const std::string& str() const
+	{ return m_str; }
+
+	size_t size() const
+	{ return m_elems.size(); }
+
+	const std::string& operator[](size_t i) const
+	{ return m_elems[i]; }
+
+	private:
+	std::string m_str;
+	std::vector<std::string> m_elems;
+};
+
 // TODO split this into nv_compound and nv_compound_base
 class nv_compound : public nv_val
 {
@@ -166,6 +273,9 @@ class nv_compound : public nv_val
 	// like get, but shouldn't throw
 	virtual csp<nv_val> find(const std::string& name) const;
 
+	csp<nv_val> get(const nv_path& path) const;
+	csp<nv_val> find(const nv_path& path) const;
+
 	virtual bool init(bool force = false);
 	virtual void clear() final
 	{ init(true); }
@@ -189,6 +299,15 @@ class nv_compound : public nv_val
 	: m_partial(partial), m_width(width), m_name(name) {}
 	virtual list definition() const = 0;
 
+	// layouts returned by definition() are validated once, and cached
+	// per type and this value. types whose definition depends on their
+	// state must return a value identifying it.
+	virtual uint64_t layout_variant() const
+	{ return 0; }
+
+	// returns the (enabled) member with the given name, or nullptr
+	virtual csp<nv_val> find_member(const std::string& name) const;
+
 	bool m_partial = false;
 	// expected final size
 	size_t m_width = 0;
@@ -198,7 +317,12 @@ class nv_compound : public nv_val
 	list m_parts;
 
 	private:
+	struct layout;
+
+	void check_layout();
+
 	std::string m_name;
+	csp<layout> m_layout;
 };
 
 template<> struct nv_type<nv_compound>
@@ -217,7 +341,14 @@ class nv_compound_def : public nv_compound
 {
 	public:
 	nv_compound_def(const std::string& name, const nv_compound::list& def, bool partial = false)
-	: nv_compound(partial), m_def(def) { nv_compound::rename(name); }
+	: nv_compound(partial), m_def(def)
+	{
+		nv_compound::rename(name);
+
+		for (auto p : m_def) {
+			m_variant = m_variant * 31 + std::hash<std::string>()(p.name);
+		}
+	}
 
 	virtual std::string type() const override
 	{ return name(); }
@@ -226,8 +357,12 @@ class nv_compound_def : public nv_compound
 	virtual list definition() const override
 	{ return m_def; }
 
+	virtual uint64_t layout_variant() const override
+	{ return m_variant; }
+
 	private:
 	nv_compound::list m_def;
+	uint64_t m_variant = 0;
 };
 
 class nv_array_base : public nv_compound
@@ -319,7 +454,7 @@ template<class T, class I, bool L> class nv_array_generic : public nv_array_base
 			if (m_parts.size() >= std::numeric_limits<I>::max()) {
 				throw bcm2dump::user_error("maximum list size reached");
 			}
-			m_parts.push_back({ std::to_string(m_count), std::make_shared<T>()});
+			m_parts.push_back({ std::to_string(m_count), nv_make<T>()});
 			m_count = m_parts.size();
 			nv_array_base::set(std::to_string(m_count - 1), val);
 		} else {
@@ -333,12 +468,15 @@ template<class T, class I, bool L> class nv_array_generic : public nv_array_base
 
 	protected:
 
+	virtual uint64_t layout_variant() const override
+	{ return m_count; }
+
 	virtual list definition() const override
 	{
 		list ret;
 
 		for (I i = 0; i < m_count; ++i) {
-			ret.push_back({ std::to_string(i), std::make_shared<T>()});
+			ret.push_back({ std::to_string(i), nv_make<T>()});
 		}
 
 		return ret;
@@ -953,8 +1091,18 @@ class nv_group : public nv_compound, public cloneable
 
 	virtual std::ostream& write(std::ostream& os) const override;
 
+	// reads a group, including its header. the group's contents are
+	// parsed from its data only, so a malformed group never consumes
+	// data of the next one.
+	//
+	// if `lazy` is set, only the group header is parsed; the group's
+	// contents are decoded when they're first accessed, which yields the
+	// same result as reading the group right away. lazily read groups that
+	// are never accessed are written back verbatim. since decoding modifies
+	// the group (even if triggered through a const member function), a
+	// group must not be accessed from multiple threads at the same time.
 	static std::istream& read(std::istream& is, sp<nv_group>& group, int format,
-			size_t remaining, const csp<bcm2dump::profile>& profile);
+			size_t remaining, const csp<bcm2dump::profile>& profile, bool lazy = false);
 	static void registry_add(const csp<nv_group>& group);
 
 	virtual nv_group* clone() const override = 0;
@@ -967,15 +1115,16 @@ class nv_group : public nv_compound, public cloneable
 
 	bool init(bool force) override;
 
+	virtual const list& parts() const override;
+
 	csp<bcm2dump::profile> profile() const
 	{ return m_profile; }
 
 	protected:
-	static std::map<nv_magic, csp<nv_group>>& registry();
-
 	virtual list definition() const override final;
 	virtual list definition(int format, const nv_version& ver) const;
 	virtual std::istream& read(std::istream& is) override;
+	virtual uint64_t layout_variant() const override;
 
 	uint16_t size() const
 	{ return m_size.num(); }
@@ -987,7 +1136,15 @@ class nv_group : public nv_compound, public cloneable
 	csp<bcm2dump::profile> m_profile;
 
 	private:
-	static std::map<nv_magic, csp<nv_group>> s_registry;
+	// parses the group's data (excluding size and magic)
+	void decode(const std::string& raw);
+	// decodes a lazily read group
+	void decode() const;
+
+	// undecoded group data (excluding size and magic)
+	mutable std::string m_raw;
+	mutable bool m_lazy = false;
+	mutable nv_arena* m_lazy_arena = nullptr;
 
 };
 
@@ -19,12 +19,13 @@
 
 #include "nonvol2.h"
 
-#define NV_VAR(type, name, ...) { name, make_shared<type>(__VA_ARGS__) }
-#define NV_VARN(type, name, ...) { name, nv_compound_rename(make_shared<type >(__VA_ARGS__), name) }
-#define NV_VAR2(type, name, ...) { name, sp<type>(new type(__VA_ARGS__)) }
-#define NV_VARN2(type, name, ...) { name, nv_compound_rename(sp<type>(new type(__VA_ARGS__)), name) }
-#define NV_VAR3(cond, type, name, ...) { name, nv_val_disable<type>(shared_ptr<type>(new type(__VA_ARGS__)), !(cond)) }
-#define NV_VARN3(cond, type, name, ...) { name, nv_compound_rename(nv_val_disable<type>(shared_ptr<type>(new type(__VA_ARGS__)), !(cond)), name) }
+#define NV_VAR(type, name, ...) { name, nv_make<type>(__VA_ARGS__) }
+#define NV_VARN(type, name, ...) { name, nv_compound_rename(nv_make<type >(__VA_ARGS__), name) }
+// arguments may contain braced initializer lists, which can't be forwarded
+#define NV_VAR2(type, name, ...) { name, nv_make<type>(type(__VA_ARGS__)) }
+#define NV_VARN2(type, name, ...) { name, nv_compound_rename(nv_make<type>(type(__VA_ARGS__)), name) }
+#define NV_VAR3(cond, type, name, ...) { name, nv_val_disable<type>(nv_make<type>(type(__VA_ARGS__)), !(cond)) }
+#define NV_VARN3(cond, type, name, ...) { name, nv_compound_rename(nv_val_disable<type>(nv_make<type>(type(__VA_ARGS__)), !(cond)), name) }
 
 
 #define NV_ARRAY(type, count) nv_array<type, count>
@@ -21,7 +21,9 @@
 #include <iostream>
 #include <cstring>
 #include <cctype>
+#include <mutex>
 #include <set>
+#include <unordered_map>
 #include "profile.h"
 #include "util.h"
 
@@ -112,7 +114,7 @@ class profile_wrapper : public profile
 {
 	public:
 	profile_wrapper(const bcm2_profile* p)
-	: m_p(p)
+	: m_p(p), m_name(p->name), m_pretty(p->pretty), m_md5_key(from_hex(p->cfg_md5key))
 	{
 		parse_spaces();
 		//parse_codecfg();
@@ -123,11 +125,11 @@ class profile_wrapper : public profile
 
 	virtual ~profile_wrapper() {}
 
-	virtual string name() const override
-	{ return m_p->name; }
+	virtual const string& name() const override
+	{ return m_name; }
 
-	virtual string pretty() const override
-	{ return m_p->pretty; }
+	virtual const string& pretty() const override
+	{ return m_pretty; }
 
 	virtual bool mipsel() const override
 	{ return m_p->mipsel; }
@@ -147,13 +149,13 @@ class profile_wrapper : public profile
 	virtual bcm2_arch arch() const override
 	{ return m_p->arch; }
 
-	virtual vector<const bcm2_magic*> magics() const override
+	virtual const vector<const bcm2_magic*>& magics() const override
 	{ return m_magic; }
 
-	virtual vector<addrspace> spaces() const override
+	virtual const vector<addrspace>& spaces() const override
 	{ return m_spaces; }
 
-	virtual vector<version> versions() const override
+	virtual const vector<version>& versions() const override
 	{ return m_versions; }
 
 	virtual const version& default_version(int intf) const override
@@ -181,8 +183,8 @@ class profile_wrapper : public profile
 	virtual const addrspace& ram() const override
 	{ return m_ram; }
 
-	virtual string md5_key() const override
-	{ return from_hex(m_p->cfg_md5key); }
+	virtual const string& md5_key() const override
+	{ return m_md5_key; }
 
 	virtual uint32_t cfg_encryption() const override
 	{ return cfg_flags() & BCM2_CFG_ENC_MASK; }
@@ -193,7 +195,7 @@ class profile_wrapper : public profile
 	virtual uint32_t cfg_flags() const override
 	{ return m_p->cfg_flags; }
 
-	virtual vector<string> default_keys() const override
+	virtual const vector<string>& default_keys() const override
 	{ return m_keys; }
 
 	virtual string derive_key(const string& pw) const override
@@ -305,6 +307,10 @@ class profile_wrapper : public profile
 	}
 
 	const bcm2_profile* m_p = nullptr;
+	// decoded once, since these are used in hot loops
+	string m_name;
+	string m_pretty;
+	string m_md5_key;
 	vector<string> m_keys;
 	vector<const bcm2_magic*> m_magic;
 	vector<version> m_versions;
@@ -552,24 +558,156 @@ func addrspace::get_erase_func(bcm2_interface intf) const
 vector<profile::sp> profile::s_profiles;
 map<string, bcm2_typed_val> profile::s_overrides;
 
-const profile::sp& profile::get(const string& name)
+namespace {
+string to_lower(string str)
 {
-	for (const profile::sp& p : list()) {
-		if (!strcasecmp(p->name().c_str(), name.c_str())) {
-			return p;
+	transform(str.begin(), str.end(), str.begin(), [] (unsigned char c) { return tolower(c); });
+	return str;
+}
+
+uint32_t get_max_magic_addr(const profile::sp& p, int intf)
+{
+	uint32_t ret = 0;
+
+	for (const auto& v : p->versions()) {
+		if (v.intf() == intf) {
+			ret = max(ret, v.magic()->addr + magic_size(v.magic()) - 1);
+		}
+	}
+
+	for (auto m : p->magics()) {
+		ret = max(ret, m->addr + magic_size(m) - 1);
+	}
+
+	return ret;
+}
+
+vector<profile_magic> build_magic_table(const vector<profile::sp>& profiles, int intf)
+{
+	struct entry
+	{
+		profile_magic pm;
+		uint32_t x;
+		size_t index;
+	};
+
+	vector<entry> entries;
+
+	for (size_t i = 0; i < profiles.size(); ++i) {
+		auto& p = profiles[i];
+		uint32_t x = get_max_magic_addr(p, intf);
+
+		for (const auto& v : p->versions()) {
+			if (v.intf() == intf) {
+				entries.push_back({ { v.magic(), p, v }, x, i });
+			}
+		}
+
+		for (auto m : p->magics()) {
+			entries.push_back({ { m, p, version() }, x, i });
+		}
+	}
+
+	stable_sort(entries.begin(), entries.end(), [] (const entry& a, const entry& b) {
+		if (a.x != b.x) {
+			return a.x < b.x;
+		} else if (a.index != b.index) {
+			return a.index < b.index;
+		}
+
+		auto& av = a.pm.v;
+		auto& bv = b.pm.v;
+
+		if (av.name().empty() != bv.name().empty()) {
+			return bv.name().empty();
+		} else if (a.pm.m->addr != b.pm.m->addr) {
+			return a.pm.m->addr < b.pm.m->addr;
+		} else if (magic_size(a.pm.m) != magic_size(b.pm.m)) {
+			// try the longer magic value first
+			return magic_size(a.pm.m) > magic_size(b.pm.m);
 		}
+
+		return av.name() < bv.name();
+	});
+
+	vector<profile_magic> ret;
+	ret.reserve(entries.size());
+
+	for (auto& e : entries) {
+		ret.push_back(e.pm);
+	}
+
+	return ret;
+}
+
+struct profile_index
+{
+	// lower-case names
+	unordered_map<string, profile::sp> names;
+	unordered_map<uint16_t, profile::sp> pssigs;
+	map<int, vector<profile_magic>> magics;
+};
+
+const profile_index& get_index()
+{
+	static const profile_index index = [] () {
+		profile_index ret;
+		auto& profiles = profile::list();
+
+		for (auto& p : profiles) {
+			ret.names.emplace(to_lower(p->name()), p);
+			// first profile wins, as with a linear search
+			ret.pssigs.emplace(p->pssig(), p);
+		}
+
+		for (int intf : { BCM2_INTF_BLDR, BCM2_INTF_BFC }) {
+			ret.magics[intf] = build_magic_table(profiles, intf);
+		}
+
+		return ret;
+	}();
+
+	return index;
+}
+}
+
+const profile::sp& profile::get(const string& name)
+{
+	auto& names = get_index().names;
+	auto it = names.find(to_lower(name));
+
+	if (it != names.end()) {
+		return it->second;
 	}
 
 	throw user_error("no such profile: " + name);
 }
 
+profile::sp profile::get_by_pssig(uint16_t pssig)
+{
+	auto& pssigs = get_index().pssigs;
+	auto it = pssigs.find(pssig);
+	return it != pssigs.end() ? it->second : nullptr;
+}
+
+const vector<profile_magic>& profile::magic_table(int intf)
+{
+	static const vector<profile_magic> empty;
+
+	auto& magics = get_index().magics;
+	auto it = magics.find(intf);
+	return it != magics.end() ? it->second : empty;
+}
+
 const vector<profile::sp>& profile::list()
 {
-	if (s_profiles.empty()) {
+	static once_flag once;
+
+	call_once(once, [] () {
 		for (const bcm2_profile* p = bcm2_profiles; p->name[0]; ++p) {
 			s_profiles.push_back(make_shared<profile_wrapper>(p));
 		}
-	}
+	});
 
 	return s_profiles;
 }
@@ -583,7 +721,7 @@ void profile::print_to_stdout(bool verbose) const
 	cout << row("pssig", 20, "0x" + to_hex(pssig())) << endl;
 	cout << row("blsig", 20, "0x" + to_hex(blsig())) << endl;
 
-	for (auto space : spaces()) {
+	for (const auto& space : spaces()) {
 		cout << endl << rpad(space.name(), 20) << "  0x" << to_hex(space.min());
 		if (space.size()) {
 			cout << " - 0x" << to_hex(space.min() + space.size() - 1);
@@ -501,6 +501,8 @@ class addrspace
 	std::vector<func> m_erase_funcs;
 };
 
+struct profile_magic;
+
 class profile
 {
 	public:
@@ -508,22 +510,22 @@ class profile
 
 	virtual ~profile() {}
 
-	virtual std::string name() const = 0;
-	virtual std::string pretty() const = 0;
+	virtual const std::string& name() const = 0;
+	virtual const std::string& pretty() const = 0;
 	virtual bool mipsel() const = 0;
 	virtual unsigned baudrate() const = 0;
 	virtual uint16_t pssig() const = 0;
 	virtual uint16_t blsig() const = 0;
 	virtual uint32_t kseg1() const = 0;
-	virtual std::vector<const bcm2_magic*> magics() const = 0;
-	virtual std::vector<version> versions() const = 0;
+	virtual const std::vector<const bcm2_magic*>& magics() const = 0;
+	virtual const std::vector<version>& versions() const = 0;
 	virtual const version& default_version(int intf) const = 0;
-	virtual std::vector<addrspace> spaces() const = 0;
+	virtual const std::vector<addrspace>& spaces() const = 0;
 	virtual const addrspace& space(const std::string& name, bcm2_interface intf) const = 0;
 	virtual const addrspace& ram() const = 0;
 	virtual bcm2_arch arch() const = 0;
 
-	virtual std::string md5_key() const = 0;
+	virtual const std::string& md5_key() const = 0;
 
 	virtual uint32_t cfg_encryption() const = 0;
 	virtual uint32_t cfg_padding() const = 0;
@@ -532,13 +534,21 @@ class profile
 	//virtual std::string encrypt(const std::string& buf, const std::string& key) = 0;
 	//virtual std::string decrypt(const std::string& buf, const std::string& key) = 0;
 
-	virtual std::vector<std::string> default_keys() const = 0;
+	virtual const std::vector<std::string>& default_keys() const = 0;
 	virtual std::string derive_key(const std::string& pw) const = 0;
 
 	void print_to_stdout(bool verbose = false) const;
 
+	// case-insensitive
 	static const sp& get(const std::string& name);
 	static const std::vector<profile::sp>& list();
+	// returns nullptr if there's no such profile
+	static sp get_by_pssig(uint16_t pssig);
+	// all magics applicable to the interface, in the order in which they're safe
+	// to probe: profiles in ascending order of their highest magic address, and
+	// within a profile, version-specific magics first, in ascending order
+	// of their address (longer ones first).
+	static const std::vector<profile_magic>& magic_table(int intf);
 
 	static void parse_opt_override(const std::string& str);
 
@@ -549,6 +559,14 @@ class profile
 	static std::map<std::string, bcm2_typed_val> s_overrides;
 };
 
+struct profile_magic
+{
+	const bcm2_magic* m;
+	profile::sp p;
+	// empty if the magic is not version-specific
+	version v;
+};
+
 uint32_t magic_size(const bcm2_magic* magic);
 std::string magic_data(const bcm2_magic* magic);
 
@@ -80,6 +80,12 @@ class ps_header
 	uint32_t length() const
 	{ return ntoh(m_raw.length); }
 
+	uint32_t length1() const
+	{ return ntoh(m_raw.length1); }
+
+	uint32_t length2() const
+	{ return ntoh(m_raw.length2); }
+
 	uint16_t control() const
 	{ return ntoh(m_raw.control); }
 
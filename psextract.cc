@@ -17,7 +17,14 @@
  *
  */
 
+#include <algorithm>
+#include <getopt.h>
 #include <fstream>
+#include <cstring>
+#include <cstddef>
+#include <cctype>
+#include <set>
+#include "decompress.h"
 #include "util.h"
 #include "ps.h"
 using namespace bcm2dump;
@@ -25,9 +32,23 @@ using namespace std;
 
 namespace {
 
+// buffer size used when copying image data
+const size_t copy_chunk_size = 1 << 20;
+// buffer size used when scanning for image headers
+const size_t scan_chunk_size = 16 << 20;
+
+template<class T> T load_be(const char* p)
+{
+	T t;
+	memcpy(&t, p, sizeof(T));
+	return ntoh(t);
+}
+
 class mono_header
 {
 	public:
+	static constexpr uint32_t c_magic = 0x4d4f4e4f;
+
 	struct raw
 	{
 		// 0x4d4f4e4f (MONO)
@@ -52,7 +73,7 @@ class mono_header
 	}
 
 	bool valid() const
-	{ return ntoh(m_raw.magic) == 0x4d4f4e4f; }
+	{ return ntoh(m_raw.magic) == c_magic; }
 
 	uint16_t signature() const
 	{ return ntoh(m_raw.signature); }
@@ -73,28 +94,103 @@ class mono_header
 	raw m_raw;
 };
 
-void do_extract(istream& in, const ps_header& ps, size_t length = 0)
+// when scanning a whole file, multiple images may share the same name
+bool unique_filenames = false;
+// write decompressed image data, instead of the raw image
+bool decompress_images = false;
+
+string output_filename(const ps_header& ps, streamoff offset)
 {
-	if (!length) {
-		length = ps.length();
+	static set<string> filenames;
+
+	string filename = ps.filename();
+	if (unique_filenames && !filenames.insert(filename).second) {
+		filename += ".0x" + to_hex(uint64_t(offset), 8);
 	}
 
-	auto buf = make_unique<char[]>(length);
+	return filename;
+}
+
+void copy_data(istream& in, ostream& out, size_t length)
+{
+	auto buf = make_unique<char[]>(min(length, copy_chunk_size));
 
-	if (!in.read(buf.get(), length)) {
-		throw runtime_error("read error (data)");
+	while (length) {
+		size_t n = min(length, copy_chunk_size);
+
+		if (!in.read(buf.get(), n)) {
+			throw runtime_error("read error (data)");
+		}
+
+		if (!out.write(buf.get(), n)) {
+			throw runtime_error("write error");
+		}
+
+		length -= n;
 	}
+}
 
-	ofstream out(ps.filename());
+// writes `length` bytes of image data, decompressing them if requested
+void write_data(istream& in, ostream& out, const ps_header& ps, size_t length)
+{
+	auto dc = decompress_images ? decompressor::create(ps.compression()) : nullptr;
+
+	if (dc) {
+		streamoff end = in.tellg() + streamoff(length);
+		uint64_t size = dc->decompress(in, length, out);
+		logger::i() << "           " << dc->name() << ": " << length << " -> " << size << " b" << endl;
+		// the decompressor may not have consumed all of the image data
+		in.seekg(end);
+	} else {
+		if (decompress_images && ps.compression() != ps_header::c_comp_none) {
+			logger::w() << "unsupported compression type " << ps.compression() << "; writing raw data" << endl;
+		}
 
-	out.write(reinterpret_cast<const char*>(ps.data()), sizeof(ps_header::raw));
-	out.write(buf.get(), length);
+		copy_data(in, out, length);
+	}
 
 	if (!out) {
 		throw runtime_error("write error");
 	}
 }
 
+void do_extract(istream& in, const ps_header& ps, size_t length = 0)
+{
+	if (!length) {
+		length = ps.length();
+	}
+
+	streamoff offset = in.tellg() - streamoff(sizeof(ps_header::raw));
+	string filename = output_filename(ps, offset);
+
+	if (ps.is_dual()) {
+		if (uint64_t(ps.length1()) + ps.length2() == length) {
+			// both images immediately follow the header, so each
+			// one is streamed to its own file.
+			uint32_t lengths[] = { ps.length1(), ps.length2() };
+			for (int i = 0; i < 2; ++i) {
+				string name = filename + "." + to_string(i + 1);
+				logger::i() << "           " << name << ", " << lengths[i] << " b" << endl;
+				ofstream out(name, ios::binary);
+				write_data(in, out, ps, lengths[i]);
+			}
+
+			return;
+		}
+
+		logger::w() << "dual image lengths " << ps.length1() << " + " << ps.length2()
+				<< " don't match image length; not splitting" << endl;
+	}
+
+	ofstream out(filename, ios::binary);
+
+	if (!decompress_images) {
+		out.write(reinterpret_cast<const char*>(ps.data()), sizeof(ps_header::raw));
+	}
+
+	write_data(in, out, ps, length);
+}
+
 string read_hbuf(istream& in)
 {
 	string hbuf(sizeof(ps_header::raw), '\0');
@@ -110,6 +206,9 @@ void extract_ps(istream& in, const ps_header& ps)
 	logger::i("0x%07lx  ", long(in.tellg()) - sizeof(ps_header::raw));
 	logger::i() << "image: " << ps.filename() << ", " << ps.length() << " b";
 	logger::v(", %04x", ps.signature());
+	if (ps.is_dual()) {
+		logger::i() << ", dual";
+	}
 	logger::i() << endl;
 
 	do_extract(in, ps);
@@ -127,7 +226,9 @@ bool extract_ps(istream& in)
 	return true;
 }
 
-void extract_image(istream& in)
+// returns the offset of the first byte following the extracted image(s),
+// or the start offset, if no image was extracted.
+streamoff extract_image(istream& in)
 {
 	ps_header ps;
 	mono_header mono;
@@ -137,8 +238,9 @@ void extract_image(istream& in)
 
 	if (ps.parse(hbuf).hcs_valid()) {
 		extract_ps(in, ps);
+		return in.tellg();
 	} else {
-		logger::i("0x%07lx  ", long(beg & 0xffffffff));
+		logger::i("0x%07llx  ", static_cast<unsigned long long>(beg));
 
 		if (mono.parse(hbuf).valid()) {
 			logger::i() << "monolithic, " << mono.length() << " b";
@@ -153,6 +255,8 @@ void extract_image(istream& in)
 				streamoff pos = in.tellg() - beg;
 				in.seekg(beg + align_right(pos, 0xffff + 1));
 			}
+
+			return end;
 		} else if (hbuf[0] == 0x30 && (hbuf[1] & 0xff) == 0x82) {
 			// add 7, because sizeof(type + len) is 4, and
 			// sizeof(end-of-data) is 2. add 1 for next data.
@@ -167,27 +271,178 @@ void extract_image(istream& in)
 			logger::e() << "unknown image format" << endl;
 		}
 	}
+
+	return beg;
+}
+
+// cheap checks that rule out most offsets before the header checksum is calculated.
+// `remaining` is the number of bytes from `p` to the end of the file.
+bool is_header_candidate(const char* p, size_t avail, uint64_t remaining, int sig)
+{
+	if (avail >= sizeof(mono_header::raw) && load_be<uint32_t>(p) == mono_header::c_magic) {
+		uint32_t len = load_be<uint32_t>(p + 8);
+		return (sig < 0 || load_be<uint16_t>(p + 4) == sig)
+				&& len > sizeof(mono_header::raw) && len <= remaining;
+	} else if (avail < sizeof(ps_header::raw)) {
+		return false;
+	} else if (sig >= 0 && load_be<uint16_t>(p) != sig) {
+		return false;
+	}
+
+	uint16_t comp = load_be<uint16_t>(p + 2) & 0x7;
+	uint32_t len = load_be<uint32_t>(p + 12);
+
+	if (comp == ps_header::c_comp_reserved || comp > ps_header::c_comp_lza) {
+		return false;
+	} else if (!len || len > (remaining - sizeof(ps_header::raw))) {
+		return false;
+	}
+
+	// the file name must be a non-empty, printable and NUL-terminated string
+	const char* name = p + offsetof(ps_header::raw, filename);
+	size_t namelen = strnlen(name, sizeof(ps_header::raw::filename));
+
+	if (!namelen || namelen == sizeof(ps_header::raw::filename)) {
+		return false;
+	}
+
+	for (size_t i = 0; i < namelen; ++i) {
+		if (!isprint(name[i] & 0xff)) {
+			return false;
+		}
+	}
+
+	return ps_header(string(p, sizeof(ps_header::raw))).hcs_valid();
+}
+
+// returns the offset of the first image header within buf[0, end), or string::npos
+size_t find_header(const char* buf, size_t size, size_t end, unsigned step, int sig, uint64_t remaining)
+{
+	for (size_t i = 0; i < end; i += step) {
+		if (sig >= 0) {
+			// skip to the next occurence of the signature's first byte. it
+			// is either found at offset 0 (ProgramStore), or at offset 4 (monolithic).
+			auto p = static_cast<const char*>(memchr(buf + i, sig >> 8, size - i));
+			if (!p) {
+				break;
+			}
+
+			size_t k = p - buf;
+			i = max<size_t>(i, align_left(k >= 4 ? k - 4 : 0, step));
+			if (i >= end) {
+				break;
+			}
+		}
+
+		if (is_header_candidate(buf + i, size - i, remaining - i, sig)) {
+			return i;
+		}
+	}
+
+	return string::npos;
+}
+
+void scan_images(istream& in, unsigned step, int sig)
+{
+	if (!in.seekg(0, ios::end)) {
+		throw runtime_error("failed to determine file size");
+	}
+
+	streamoff size = in.tellg();
+	size_t chunk = max<size_t>(align_left(scan_chunk_size, step), step);
+	string buf(chunk + sizeof(ps_header::raw), '\0');
+	streamoff pos = 0;
+
+	while (pos < size) {
+		in.clear();
+		in.seekg(pos);
+		in.read(&buf[0], buf.size());
+
+		size_t n = in.gcount();
+		size_t i = find_header(buf.data(), n, min(n, chunk), step, sig, size - pos);
+
+		if (i == string::npos) {
+			pos += chunk;
+			continue;
+		}
+
+		streamoff offset = pos + i;
+		streamoff end = offset;
+
+		try {
+			in.clear();
+			in.seekg(offset);
+			end = extract_image(in);
+		} catch (const exception& e) {
+			logger::w() << "0x" << to_hex(uint64_t(offset), 8) << ": " << e.what() << endl;
+		}
+
+		// don't rescan data belonging to an image that was just extracted
+		pos = end > offset ? align_right(end, step) : offset + step;
+	}
+}
+
+int usage()
+{
+	ostream& os = logger::e();
+
+	os << "Usage: psextract [<options>] <infile> [<offset1> ...]" << endl;
+	os << endl;
+	os << "Options:" << endl;
+	os << "  -d               Write decompressed image data, without header" << endl;
+	os << "  -s <step>        Scan whole file for images, in steps of <step> bytes" << endl;
+	os << "  -S <signature>   Only consider images with this signature" << endl;
+
+	return 1;
 }
 
 int do_main(int argc, char* argv[])
 {
 	logger::loglevel(logger::debug);
 
-	if (argc < 2) {
-		logger::e() << "Usage: psextract <infile> [<offset1> ...]" << endl;
-		return 1;
+	unsigned step = 0;
+	int sig = -1;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "+ds:S:")) != -1) {
+		switch (opt) {
+		case 'd':
+			decompress_images = true;
+			break;
+		case 's':
+			step = lexical_cast<unsigned>(optarg, 0);
+			if (!step) {
+				throw user_error("step must not be 0");
+			}
+			break;
+		case 'S':
+			sig = lexical_cast<uint16_t>(optarg, 16);
+			break;
+		default:
+			return usage();
+		}
+	}
+
+	argv += optind;
+	argc -= optind;
+
+	if (argc < 1 || (step && argc != 1)) {
+		return usage();
 	}
 
-	ifstream in(argv[1]);
+	ifstream in(argv[0], ios::binary);
 
 	if (!in.good()) {
 		throw user_error("failed to open input file");
 	}
 
-	if (argc == 2) {
+	if (step) {
+		unique_filenames = true;
+		scan_images(in, step, sig);
+	} else if (argc == 1) {
 		extract_image(in);
 	} else {
-		for (int i = 2; i < argc; ++i) {
+		for (int i = 1; i < argc; ++i) {
 			if (!in.seekg(lexical_cast<unsigned>(argv[i], 0))) {
 				throw user_error("bad offset "s + argv[i]);
 			}
@@ -248,14 +248,14 @@ string parsing_rwx::read_special(uint32_t offset, uint32_t length)
 
 string parsing_rwx::read_chunk_impl(uint32_t offset, uint32_t length, uint32_t retries)
 {
-	logger::t() << "read_chunk_impl: calling do_read_chunk" << endl;
+	LOG_T() << "read_chunk_impl: calling do_read_chunk" << endl;
 
 	do_read_chunk(offset, length);
 
 	uint32_t pos = offset;
 	string chunk;
 
-	logger::t() << "read_chunk_impl: consuming lines" << endl;
+	LOG_T() << "read_chunk_impl: consuming lines" << endl;
 
 	interface()->foreach_line_raw([this, &chunk, &pos, &length, &retries] (const string& line) {
 		throw_if_interrupted();
@@ -268,7 +268,7 @@ string parsing_rwx::read_chunk_impl(uint32_t offset, uint32_t length, uint32_t r
 				update_progress(pos, chunk.size());
 
 				if (linebuf.empty()) {
-					logger::t() << "no bytes found in '" << tline << "'" << endl;
+					LOG_T() << "no bytes found in '" << tline << "'" << endl;
 				}
 			} catch (const bad_chunk_line& e) {
 				string msg = "bad chunk line @" + to_hex(pos) + ": '" + tline + "' (" + e.what() + ")";
@@ -276,9 +276,9 @@ string parsing_rwx::read_chunk_impl(uint32_t offset, uint32_t length, uint32_t r
 					throw runtime_error(msg);
 				}
 
-				logger::t() << endl << msg << endl;
+				LOG_T() << endl << msg << endl;
 			} catch (const exception& e) {
-				logger::d() << "error while parsing '" << tline << "': " << e.what() << endl;
+				LOG_D() << "error while parsing '" << tline << "': " << e.what() << endl;
 				return true;
 			}
 		}
@@ -286,7 +286,7 @@ string parsing_rwx::read_chunk_impl(uint32_t offset, uint32_t length, uint32_t r
 		return !(chunk.size() < length);
 	}, 10000);
 
-	logger::t() << "read_chunk_impl: done reading lines" << endl;
+	LOG_T() << "read_chunk_impl: done reading lines" << endl;
 
 	// consume any more output
 	interface()->wait_quiet(20);
@@ -299,7 +299,7 @@ string parsing_rwx::read_chunk_impl(uint32_t offset, uint32_t length, uint32_t r
 			// before issuing the next command. wait for up to 10 seconds.
 
 			if (interface()->wait_ready()) {
-				logger::d() << endl << msg << "; retrying" << endl;
+				LOG_D() << endl << msg << "; retrying" << endl;
 				on_chunk_retry(offset, length);
 				return read_chunk_impl(offset, length, retries + 1);
 			}
@@ -626,7 +626,7 @@ void bfc_flash::init(uint32_t, uint32_t, bool write)
 		if (opened) {
 			break;
 		} else if (pass == 0) {
-			logger::d() << "reinitializing flash driver" << endl;
+			LOG_D() << "reinitializing flash driver" << endl;
 			cleanup();
 			interface()->run("/flash/deinit", "Deinitializing");
 			interface()->run("/flash/init", 5000);
@@ -1223,7 +1223,7 @@ rwx::sp create_code_rwx(const interface::sp& intf, const addrspace& space)
 		ret->set_addrspace(space);
 		return ret;
 	} catch (const exception& e) {
-		logger::d() << e.what() << endl;
+		LOG_D() << e.what() << endl;
 		logger::i() << "falling back to safe method" << endl;
 		return rwx::create(intf, space.name(), true);
 	}
@@ -1475,7 +1475,7 @@ void rwx::dump(uint32_t offset, uint32_t length, std::ostream& os, bool resume)
 		} else {
 			offset += completed;
 			length -= completed;
-			logger::v() << "resuming at offset 0x" + to_hex(offset) << endl;
+			LOG_V() << "resuming at offset 0x" + to_hex(offset) << endl;
 			os.seekp(completed, ios::cur);
 		}
 	}
@@ -1485,7 +1485,7 @@ void rwx::dump(uint32_t offset, uint32_t length, std::ostream& os, bool resume)
 	uint32_t length_w = length;
 
 	if (offset_r != offset || length_r != length) {
-		logger::d() << "adjusting dump params: 0x" << to_hex(offset) << "," << length
+		LOG_D() << "adjusting dump params: 0x" << to_hex(offset) << "," << length
 				<< " -> 0x" << to_hex(offset_r) << "," << length_r << endl;
 	}
 
@@ -1606,7 +1606,7 @@ void rwx::write(uint32_t offset, const string& buf, uint32_t length)
 	uint32_t length_w = align_right(length + (offset - offset_w), lim.min);
 
 	if (offset_w != offset || length_w != length) {
-		logger::d() << "adjusting write params: 0x" << to_hex(offset) << "," << length
+		LOG_D() << "adjusting write params: 0x" << to_hex(offset) << "," << length
 				<< " -> 0x" << to_hex(offset_w) << "," << length_w << endl;
 		throw user_error("non-aligned writes are not yet supported; alignment is " + to_string(lim.min));
 	}
@@ -1667,7 +1667,7 @@ void rwx::write(uint32_t offset, const string& buf, uint32_t length)
 					}
 
 					if (++retries < 5 /*&& wait_for_interface(interface())*/) {
-						logger::d() << endl << msg << "; retrying" << endl;
+						LOG_D() << endl << msg << "; retrying" << endl;
 						//on_chunk_retry(offset_w, chunk.size());
 						continue;
 					}
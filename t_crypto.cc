@@ -0,0 +1,237 @@
+/**
+ * bcm2-utils
+ * Copyright (C) 2016 Joseph C. Lehner <joseph.c.lehner@gmail.com>
+ *
+ * bcm2-utils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bcm2-utils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with bcm2-utils.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <iostream>
+#include <cstdlib>
+#include <ctime>
+#include "crypto.h"
+#include "util.h"
+using namespace std;
+using namespace bcm2dump;
+using namespace bcm2utils;
+
+namespace {
+
+class failed_test : public runtime_error
+{
+	public:
+	explicit failed_test(const string& msg) : runtime_error(msg) {}
+};
+
+// reference implementations, as originally written
+
+string ref_sub_16x16(string buf, bool encrypt)
+{
+	for (size_t i = 0; i < (buf.size() / 16) * 16; i += 2) {
+		unsigned k = i & 0xff;
+
+		if (encrypt) {
+			buf[i] = (buf[i] + k) & 0xff;
+		} else {
+			buf[i] = (buf[i] - k) & 0xff;
+		}
+	}
+
+	for (size_t i = 0; (i + 1) < buf.size(); i += 2) {
+		swap(buf[i], buf[i + 1]);
+	}
+
+	return buf;
+}
+
+string ref_xor_char(string buf, const string& key)
+{
+	for (size_t i = 0; i < buf.size(); ++i) {
+		buf[i] ^= (key[0] & 0xff);
+	}
+
+	return buf;
+}
+
+string ref_motorola(string buf, const string& key)
+{
+	uint32_t seed = key[0] & 0xff;
+
+	for (size_t i = 0; i < buf.size(); ++i) {
+		uint32_t result, next = seed;
+
+		next *= 0x41c64e6d;
+		next += 0x3039;
+		result = next & 0xffe00000;
+
+		next *= 0x41c64e6d;
+		next += 0x3039;
+		result += (next & 0xfffc0000) >> 11;
+
+		next *= 0x41c64e6d;
+		next += 0x3039;
+		result = (result + (next >> 25)) & 0x7fffffff;
+
+		seed = next;
+
+		double r = result;
+		int x = ((r / 0x7fffffff) * 255) + 1;
+		buf[i] ^= x;
+	}
+
+	return buf;
+}
+
+string random_data(size_t size)
+{
+	string ret(size, '\0');
+	for (char& c : ret) {
+		c = rand() & 0xff;
+	}
+	return ret;
+}
+
+void expect_equal(const string& name, const string& data, const string& expected, const string& actual)
+{
+	if (expected != actual) {
+		throw failed_test(name + ": output does not match reference (" + to_string(data.size()) + " bytes)\n"
+				"    data: " + to_hex(data) + "\n"
+				"expected: " + to_hex(expected) + "\n"
+				"  actual: " + to_hex(actual));
+	}
+}
+
+// covers all lengths around the 16 and 32 byte boundaries of the vectorized
+// code paths. data is placed at all offsets within a block, so that loads and
+// stores are unaligned as well.
+template<class F1, class F2> void test_cipher(const string& name, const F1& ref, const F2& crypter)
+{
+	for (size_t size = 0; size < 300; ++size) {
+		for (size_t offset = 0; offset < 32; offset += (size < 100 ? 1 : 7)) {
+			string data = random_data(size);
+			string buf = random_data(offset) + data;
+
+			if (size) {
+				crypter(&buf[offset], size);
+			}
+
+			expect_equal(name, data, ref(data), buf.substr(offset));
+		}
+	}
+
+	string data = random_data(100000);
+	string buf = data;
+	crypter(&buf[0], buf.size());
+	expect_equal(name, data, ref(data), buf);
+
+	cout << "OK " << name << endl;
+}
+
+void test_sub_16x16()
+{
+	for (bool encrypt : { false, true }) {
+		test_cipher("sub-16x16"s + (encrypt ? " enc" : " dec"),
+				[encrypt] (const string& data) { return ref_sub_16x16(data, encrypt); },
+				[encrypt] (char* buf, size_t size) { crypt_sub_16x16(buf, size, encrypt); });
+	}
+}
+
+void test_xor_char()
+{
+	for (int k : { 0x00, 0x5a, 0x80, 0xff }) {
+		string key(1, char(k));
+		test_cipher("xor " + to_hex(k, 2),
+				[&key] (const string& data) { return ref_xor_char(data, key); },
+				[&key] (char* buf, size_t size) { crypt_xor_char(buf, size, key); });
+	}
+}
+
+void test_motorola()
+{
+	for (int k : { 0x00, 0x01, 0x5a, 0xff }) {
+		string key(1, char(k));
+		test_cipher("motorola " + to_hex(k, 2),
+				[&key] (const string& data) { return ref_motorola(data, key); },
+				[&key] (char* buf, size_t size) { crypt_motorola(buf, size, key); });
+	}
+}
+// buffers above a certain size are processed in chunks, using multiple
+// threads, which must yield the same result as processing them serially.
+void test_parallel()
+{
+	typedef string (*crypter)(const string&, const string&, bool);
+
+	struct cipher
+	{
+		string name;
+		crypter func;
+		size_t keysize;
+		string key;
+		string expected[2];
+	} ciphers[] = {
+		{ "aes-256-ecb", &crypt_aes_256_ecb, 32 },
+		{ "aes-128-cbc", &crypt_aes_128_cbc, 32 },
+		{ "3des-ecb", &crypt_3des_ecb, 24 },
+		{ "des-ecb", &crypt_des_ecb, 8 },
+	};
+
+	string data = random_data(3 * 1024 * 1024 + 48);
+
+	default_jobs(1);
+
+	for (auto& c : ciphers) {
+		c.key = random_data(c.keysize);
+		for (bool encrypt : { false, true }) {
+			c.expected[encrypt] = c.func(data, c.key, encrypt);
+		}
+	}
+
+	default_jobs(4);
+
+	// the ciphers are tested in parallel as well, so nested calls
+	// to parallel_for are covered too.
+	parallel_for(4, 4, [&] (size_t i) {
+		auto& c = ciphers[i];
+		for (bool encrypt : { false, true }) {
+			if (c.func(data, c.key, encrypt) != c.expected[encrypt]) {
+				throw failed_test(c.name + (encrypt ? " enc" : " dec")
+						+ ": parallel output does not match serial output");
+			}
+		}
+	});
+
+	default_jobs(0);
+
+	for (auto& c : ciphers) {
+		cout << "OK parallel " << c.name << endl;
+	}
+}
+}
+
+int main()
+{
+	srand(time(nullptr));
+
+	try {
+		test_sub_16x16();
+		test_xor_char();
+		test_motorola();
+		test_parallel();
+	} catch (const exception& e) {
+		cerr << "TEST FAILED" << endl << e.what() << endl;
+		return 1;
+	}
+
+	return 0;
+}
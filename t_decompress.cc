@@ -0,0 +1,291 @@
+/**
+ * bcm2-utils
+ * Copyright (C) 2016 Joseph C. Lehner <joseph.c.lehner@gmail.com>
+ *
+ * bcm2-utils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bcm2-utils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with bcm2-utils.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <iostream>
+#include <sstream>
+#include "decompress.h"
+#include "util.h"
+#include "ps.h"
+using namespace std;
+using namespace bcm2dump;
+
+namespace {
+
+class failed_test : public runtime_error
+{
+	public:
+	explicit failed_test(const string& msg) : runtime_error(msg) {}
+};
+
+// the uncompressed data of the lzma fixture
+string lzma_data()
+{
+	string ret;
+
+	for (int i = 0; i < 200; ++i) {
+		ret += "line " + to_string(i) + ": the quick brown fox jumps over the lazy dog\n";
+	}
+
+	uint32_t x = 1;
+	for (int i = 0; i < 256; ++i) {
+		x = x * 1103515245 + 12345;
+		ret += char(x >> 24);
+	}
+
+	return ret;
+}
+
+// lzma_data(), compressed using `xz --format=lzma`. the header specifies
+// an unknown uncompressed size, so the stream has an end marker.
+const string lzma_fixture = from_hex(
+		"5d00008000ffffffffffffffff00361a4a1f08a026564e0d6cb8a5ed639c8e7c"
+		"db4ef69e4b7818565cf726ebd4a36e1c46100c586ae741921d7f584bc57f5f6a"
+		"fe1bf3a7c4ba2caff3ec95f09a6ff30a13116ff50237735a9e873967932370f9"
+		"87e5e2901c0b6b0487164c6ed3496fe10fb137b7d7e0e7925dfeb525687e7516"
+		"015b7b0b31cb0356204d7fc916977fc3797afa49f5d8cce55318bf17997b3bc2"
+		"f1add17b5beaccaf17406801d77fe41c480538ca5a8813fd6b48ff3a483164b7"
+		"068cd8e1d378313eab2d881d336bd88d679f5b65926e195354e4413fe4a6c997"
+		"8eb07d7ddce6c3182f63f41a79e9758fa17e682f2f8cedc3bbffc50b9c705495"
+		"f7b5df464ab22c12a3a331802be4afc6f961fa7c17756c88b88d68b2b96606db"
+		"31dd5863ee851e584f56e0a55cfe56633ee5807ef58bff945db1c8b4638e9ea6"
+		"df71f86fbabb55d9043fc43b59de3113ab6303907a2ec19364193e65bd424a89"
+		"ffc23d5c716839a98ab18b0ac671b28a6509710d7e2f62b54d11d807aa0ebe0e"
+		"692dc36ce8d90d015e9591acda58f49710a626757786b2c56ae505077378931c"
+		"cd686a00b428800d04ebabb1d433043c2c04aadc3ba5bde113be5741c781aecf"
+		"4b96822035e2c7d3b456ab8c4ffa5b42334dbbb114548814e92bfce99a03ec38"
+		"d06d05f3228f7d38925e2274d5e36b55a748daaeb997cd0836c16b15e652c773"
+		"7e2e26f3fb7a4920af0478bac3c9e4b5ef2f58d59057e391f49a66aedf25e484"
+		"5f575fffb254a000"
+);
+
+string decompress(uint16_t compression, const string& data)
+{
+	istringstream in(data);
+	ostringstream out;
+
+	uint64_t size = decompressor::create(compression)->decompress(in, data.size(), out);
+	if (size != out.str().size()) {
+		throw failed_test("returned size " + to_string(size) + " does not match output size "
+				+ to_string(out.str().size()));
+	}
+
+	return out.str();
+}
+
+void expect_output(const string& name, uint16_t compression, const string& data, const string& expected)
+{
+	string actual;
+
+	try {
+		actual = decompress(compression, data);
+	} catch (const exception& e) {
+		throw failed_test(name + ": " + e.what());
+	}
+
+	if (actual != expected) {
+		throw failed_test(name + ": output does not match (" + to_string(actual.size())
+				+ " b, expected " + to_string(expected.size()) + " b)");
+	}
+
+	cout << "OK " << name << endl;
+}
+
+// corrupted input must be rejected, or at least must not yield the original
+// data; either way, the decompressor must not crash.
+void expect_failure(const string& name, uint16_t compression, const string& data, const string& expected)
+{
+	try {
+		if (decompress(compression, data) != expected) {
+			cout << "OK " << name << endl;
+			return;
+		}
+	} catch (const failed_test& e) {
+		throw;
+	} catch (const exception& e) {
+		cout << "OK " << name << " (" << e.what() << ")" << endl;
+		return;
+	}
+
+	throw failed_test(name + ": corrupted data was accepted");
+}
+
+void test_lzma()
+{
+	string expected = lzma_data();
+	string data = lzma_fixture;
+
+	expect_output("lzma", ps_header::c_comp_lz, data, expected);
+	expect_output("lza", ps_header::c_comp_lza, data, expected);
+
+	// same stream, with the uncompressed size in the header
+	for (int i = 0; i < 8; ++i) {
+		data[5 + i] = (uint64_t(expected.size()) >> (8 * i)) & 0xff;
+	}
+
+	expect_output("lzma with size", ps_header::c_comp_lz, data, expected);
+
+	for (size_t size : { size_t(0), size_t(4), size_t(12), data.size() / 2, data.size() - 1 }) {
+		expect_failure("lzma truncated to " + to_string(size), ps_header::c_comp_lz,
+				data.substr(0, size), expected);
+	}
+
+	data = lzma_fixture;
+	data[0] = char(0xe1);
+	expect_failure("lzma invalid properties", ps_header::c_comp_lz, data, expected);
+
+	data = lzma_fixture;
+	data[4] = 0x20;
+	expect_failure("lzma invalid dictionary size", ps_header::c_comp_lz, data, expected);
+
+	data = lzma_fixture;
+	data[13] = 1;
+	expect_failure("lzma invalid range coder data", ps_header::c_comp_lz, data, expected);
+
+	for (size_t i = 14; i < lzma_fixture.size(); i += 37) {
+		data = lzma_fixture;
+		data[i] ^= 0x55;
+		expect_failure("lzma corrupted at " + to_string(i), ps_header::c_comp_lz, data, expected);
+	}
+}
+
+// builds an LZO1X stream instruction by instruction, along with its
+// expected output.
+class lzo_stream
+{
+	public:
+	lzo_stream& op(initializer_list<int> bytes)
+	{
+		for (int b : bytes) {
+			m_data += char(b);
+		}
+
+		return *this;
+	}
+
+	lzo_stream& literals(const string& str)
+	{
+		m_data += str;
+		m_expected += str;
+		return *this;
+	}
+
+	lzo_stream& match(size_t dist, size_t len)
+	{
+		while (len--) {
+			m_expected += m_expected[m_expected.size() - dist];
+		}
+
+		return *this;
+	}
+
+	const string& data() const
+	{ return m_data; }
+
+	const string& expected() const
+	{ return m_expected; }
+
+	private:
+	string m_data;
+	string m_expected;
+};
+
+string pattern(size_t size)
+{
+	string ret;
+
+	for (size_t i = 0; i < size; ++i) {
+		ret += char((i * 7 + 3) & 0xff);
+	}
+
+	return ret;
+}
+
+void test_lzo()
+{
+	// no LZO compressor is available to the test suite, so this stream is
+	// assembled according to the LZO1X bitstream description, covering
+	// every instruction type that miniLZO emits. comments give the
+	// state (number of literals copied by the previous instruction; 4
+	// for a literal run) in which an instruction is decoded.
+	lzo_stream s;
+
+	// first byte 18..255: literal run of (byte - 17) bytes
+	s.op({ 0x19 }).literals("abcdefgh");
+	// state 4, 64..255 (M2): 0 1 L D D D S S, H; len 3 + L,
+	// dist 1 + (H << 3) + D, S trailing literals
+	s.op({ 0x7e, 0x00 }).match(8, 4).literals("XY");
+	// state 1..3, 0..15 (M1): 0 0 0 0 D D S S, H; len 2, dist 1 + (H << 2) + D
+	s.op({ 0x04, 0x03 }).match(14, 2);
+	// state 0, 1..15: literal run of (byte + 3) bytes
+	s.op({ 0x02 }).literals("12345");
+	// state 4, 32..63 (M3): 0 0 1 L L L L L; L == 0: len 33 + zero run,
+	// followed by D as LE16; dist 1 + (D >> 2), S = D & 3 trailing literals.
+	// overlapping match.
+	s.op({ 0x20, 0x00, 0x05, 0x51, 0x00 }).match(21, 293).literals("Z");
+	// state 1, M1 with distance 1, 3 trailing literals
+	s.op({ 0x03, 0x00 }).match(1, 2).literals("pqr");
+	// state 3, M3 with 64 zero bytes in the length
+	s.op({ 0x20 });
+	for (int i = 0; i < 64; ++i) {
+		s.op({ 0x00 });
+	}
+	s.op({ 0x10, 0xac, 0x04 }).match(300, 33 + 64 * 255 + 0x10);
+	// state 0, 0: literal run of 18 + zero run bytes
+	s.op({ 0x00, 0x00, 0x02 }).literals(pattern(275));
+	// state 4, 0..15 (M1): len 3, dist 2049 + (H << 2) + D
+	s.op({ 0x09, 0x10 }).match(2049 + (0x10 << 2) + 2, 3).literals("!");
+	// state 1, 16..31 (M4): 0 0 0 1 H L L L, D as LE16; len 2 + L,
+	// dist 16384 + (H << 14) + (D >> 2), S = D & 3 trailing literals
+	s.op({ 0x15, 0x92, 0x01 }).match(16384 + 100, 7).literals("@#");
+	// state 2, M4 with L == 0: len 9 + zero run
+	s.op({ 0x10, 0x04, 0xd0, 0x07 }).match(16384 + 500, 13);
+	// end of stream: M4 with len 3 and dist 16384
+	s.op({ 0x11, 0x00, 0x00 });
+
+	expect_output("mini-lzo", ps_header::c_comp_mini_lzo, s.data(), s.expected());
+
+	for (size_t size : { size_t(0), size_t(1), size_t(20), s.data().size() / 2, s.data().size() - 1 }) {
+		expect_failure("mini-lzo truncated to " + to_string(size), ps_header::c_comp_mini_lzo,
+				s.data().substr(0, size), s.expected());
+	}
+
+	// a match that reaches before the start of the output
+	lzo_stream bad;
+	bad.op({ 0x19 }).literals("abcdefgh").op({ 0x7e, 0x01 }).literals("XY").op({ 0x11, 0x00, 0x00 });
+	expect_failure("mini-lzo invalid distance", ps_header::c_comp_mini_lzo, bad.data(), "abcdefgh");
+
+	// an end of stream marker with an invalid length
+	bad = lzo_stream();
+	bad.op({ 0x19 }).literals("abcdefgh").op({ 0x12, 0x00, 0x00 });
+	expect_failure("mini-lzo invalid end of stream", ps_header::c_comp_mini_lzo, bad.data(), "abcdefgh");
+}
+}
+
+int main()
+{
+	try {
+		test_lzma();
+		test_lzo();
+	} catch (const exception& e) {
+		cerr << "TEST FAILED" << endl << e.what() << endl;
+		return 1;
+	}
+
+	return 0;
+}
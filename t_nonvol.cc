@@ -112,6 +112,122 @@ void test_group()
 				"  actual: " + to_hex(data2));
 	}
 
+	sp<nv_group> lazy;
+	istr.clear();
+	istr.str(data1);
+
+	nv_group::read(istr, lazy, nv_group::fmt_dyn, data1.size(), nullptr, true);
+
+	if (!lazy || lazy->version().num() != 1 || serialize(lazy) != data1) {
+		throw failed_test("failed to lazily read group");
+	} else if (lazy->get("str")->to_str() != "foobar" || serialize(lazy) != data1) {
+		throw failed_test("failed to decode lazily read group");
+	}
+
+	// the string value is truncated at the embedded nul byte, so this
+	// group's data is longer than its contents. this must not affect the
+	// following group, and the group must be decoded the same way, whether
+	// it's read lazily or not.
+	class test2 : public nv_group
+	{
+		public:
+		test2() : nv_group("TST2", "test2") {}
+
+		virtual test2* clone() const override
+		{ return new test2(*this); }
+
+		virtual list definition(int type, const nv_version& ver) const override
+		{
+			return {
+				NV_VAR(nv_p8zstring, "str"),
+			};
+		}
+	};
+
+	nv_group::registry_add(make_shared<test2>());
+
+	string data3 = "\x00\x0eTST2\x00\x01" "\x05" "ab\x00" "c\x00"s + data1;
+	string pretty;
+
+	for (bool lazy : { false, true }) {
+		sp<nv_group> g1, g2;
+		istringstream istr3(data3);
+
+		nv_group::read(istr3, g1, nv_group::fmt_dyn, data3.size(), nullptr, lazy);
+		nv_group::read(istr3, g2, nv_group::fmt_dyn, data1.size(), nullptr, lazy);
+
+		if (!g1 || !g2 || g2->get("str")->to_str() != "foobar") {
+			throw failed_test("failed to read group following " + (g1 ? g1->type() : "group"));
+		} else if (g1->get("str")->to_str() != "ab") {
+			throw failed_test(g1->type() + ": unexpected value " + g1->get("str")->to_str());
+		} else if (g1->to_pretty() != (lazy ? pretty : (pretty = g1->to_pretty()))) {
+			throw failed_test(g1->type() + ": lazy and immediate decoding differ\n"
+					"expected: " + pretty + "\n"
+					"  actual: " + g1->to_pretty());
+		}
+	}
+
+	// setting a nested member must update the size of every level
+	class user : public nv_compound
+	{
+		public:
+		user() : nv_compound(false) {}
+
+		virtual string type() const override
+		{ return "user"; }
+
+		virtual list definition() const override
+		{
+			return {
+				NV_VAR(nv_p8string, "name"),
+				NV_VAR(nv_u8, "flags"),
+			};
+		}
+	};
+
+	class test3 : public nv_group
+	{
+		public:
+		test3() : nv_group("TST3", "test3") {}
+
+		virtual test3* clone() const override
+		{ return new test3(*this); }
+
+		virtual list definition(int type, const nv_version& ver) const override
+		{
+			return {
+				NV_VAR(nv_u8, "byte"),
+				NV_VAR(nv_p8list<user>, "users"),
+			};
+		}
+	};
+
+	nv_group::registry_add(make_shared<test3>());
+
+	string data4 = "\x00\x0eTST3\x00\x01" "\x2a" "\x01" "\x02" "ab" "\x07"s;
+	istringstream istr4(data4);
+	sp<nv_group> g3;
+
+	nv_group::read(istr4, g3, nv_group::fmt_dyn, data4.size(), nullptr);
+	if (!g3) {
+		throw failed_test("failed to read group with nested members");
+	}
+
+	g3->set("users.0.name", "foobar");
+
+	for (auto t : vector<pair<string, size_t>> { { "users.0", 8 }, { "users", 9 } }) {
+		if (g3->get(t.first)->bytes() != t.second) {
+			throw failed_test("set: " + t.first + ": expected size " + to_string(t.second)
+					+ ", got " + to_string(g3->get(t.first)->bytes()));
+		}
+	}
+
+	string data5 = serialize(g3);
+	if (data5 != "\x00\x12TST3\x00\x01" "\x2a" "\x01" "\x06" "foobar" "\x07"s) {
+		throw failed_test(g3->type() + ": unexpected data after nested set\n"
+				"  actual: " + to_hex(data5));
+	}
+
 	struct {
 		std::string name;
 		std::string value;
@@ -17,8 +17,22 @@
  *
  */
 
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <array>
+#include <cstdio>
+#include <unistd.h>
+#include <fcntl.h>
 #include "profile.h"
 #include "util.h"
+
+#ifdef _WIN32
+#include <io.h>
+#endif
+
 using namespace std;
 
 namespace bcm2dump {
@@ -199,21 +213,29 @@ string from_hex(const string& hexstr)
 
 uint16_t crc16_ccitt(const void* buf, size_t size)
 {
-	uint32_t crc = 0xffff;
-	uint32_t poly = 0x1021;
-
-	for (size_t i = 0; i < size; ++i) {
-		for (size_t k = 0; k < 8; ++k) {
-			bool bit = (reinterpret_cast<const char*>(buf)[i] >> (7 - k) & 1);
-			bool c15 = (crc >> 15 & 1);
-			crc <<= 1;
-			if (c15 ^ bit) {
-				crc ^= poly;
+	static const auto table = [] {
+		array<uint16_t, 256> ret;
+		uint32_t poly = 0x1021;
+
+		for (uint32_t i = 0; i < 256; ++i) {
+			uint32_t crc = i << 8;
+			for (size_t k = 0; k < 8; ++k) {
+				crc = (crc << 1) ^ ((crc & 0x8000) ? poly : 0);
 			}
+			ret[i] = crc & 0xffff;
 		}
+
+		return ret;
+	}();
+
+	auto p = reinterpret_cast<const uint8_t*>(buf);
+	uint16_t crc = 0xffff;
+
+	for (size_t i = 0; i < size; ++i) {
+		crc = (crc << 8) ^ table[((crc >> 8) ^ p[i]) & 0xff];
 	}
 
-	return crc & 0xffff;
+	return crc;
 }
 
 std::string transform(const std::string& str, std::function<int(int)> f)
@@ -228,8 +250,226 @@ std::string transform(const std::string& str, std::function<int(int)> f)
 	return ret;
 }
 
+bool write_file_atomic(const string& filename, const string& data)
+{
+	string tmp;
+#ifndef _WIN32
+	tmp = filename + ".XXXXXX";
+	int fd = mkstemp(&tmp[0]);
+#else
+	int fd = -1;
+	for (unsigned i = 0; fd < 0 && i < 100; ++i) {
+		tmp = filename + "." + to_string(getpid()) + "." + to_string(i);
+		fd = open(tmp.c_str(), O_CREAT | O_EXCL | O_WRONLY | O_BINARY, 0600);
+		if (fd < 0 && errno != EEXIST) {
+			break;
+		}
+	}
+#endif
+
+	if (fd < 0) {
+		return false;
+	}
+
+	bool ok = true;
+
+	for (size_t i = 0; ok && i < data.size();) {
+		ssize_t n = write(fd, data.data() + i, data.size() - i);
+		if (n <= 0) {
+			ok = false;
+		} else {
+			i += n;
+		}
+	}
+
+	ok &= (close(fd) == 0);
+
+#ifndef _WIN32
+	ok = ok && rename(tmp.c_str(), filename.c_str()) == 0;
+#else
+	// rename() fails if the destination exists
+	ok = ok && MoveFileExA(tmp.c_str(), filename.c_str(), MOVEFILE_REPLACE_EXISTING);
+#endif
+
+	if (!ok) {
+		int err = errno;
+		unlink(tmp.c_str());
+		errno = err;
+	}
+
+	return ok;
+}
+
+namespace {
+unsigned jobs_override = 0;
+
+// threads are started as needed, and wait for new jobs once they're done.
+// each job is also worked on by the thread that submitted it, so a job
+// can always be finished, even if all pool threads are busy.
+class thread_pool
+{
+	public:
+	struct job
+	{
+		const function<void(size_t)>* func;
+		size_t count;
+		// number of pool threads that may still join this job
+		unsigned helpers;
+		// number of pool threads currently working on this job
+		unsigned active = 0;
+		atomic<size_t> next{0};
+		exception_ptr error;
+		mutex error_lock;
+
+		void run()
+		{
+			size_t i;
+			while ((i = next++) < count) {
+				try {
+					(*func)(i);
+				} catch (...) {
+					lock_guard<mutex> guard(error_lock);
+					if (!error) {
+						error = current_exception();
+					}
+					next = count;
+				}
+			}
+		}
+	};
+
+	~thread_pool()
+	{
+		{
+			lock_guard<mutex> guard(m_lock);
+			m_stop = true;
+		}
+
+		m_work.notify_all();
+
+		for (auto& t : m_threads) {
+			t.join();
+		}
+	}
+
+	static thread_pool& instance()
+	{
+		static thread_pool pool;
+		return pool;
+	}
+
+	void run(job& j)
+	{
+		{
+			lock_guard<mutex> guard(m_lock);
+
+			while (m_threads.size() < j.helpers) {
+				m_threads.emplace_back([this] { worker(); });
+			}
+
+			m_jobs.push_back(&j);
+		}
+
+		m_work.notify_all();
+		j.run();
+
+		unique_lock<mutex> lock(m_lock);
+		// remove the job, if no pool thread picked it up in the meantime
+		m_jobs.erase(remove(m_jobs.begin(), m_jobs.end(), &j), m_jobs.end());
+		m_done.wait(lock, [&j] { return !j.active; });
+	}
+
+	private:
+	void worker()
+	{
+		unique_lock<mutex> lock(m_lock);
+
+		while (true) {
+			m_work.wait(lock, [this] { return m_stop || !m_jobs.empty(); });
+			if (m_stop) {
+				return;
+			}
+
+			job* j = m_jobs.front();
+			++j->active;
+			if (!--j->helpers) {
+				m_jobs.pop_front();
+			}
+
+			lock.unlock();
+			j->run();
+			lock.lock();
+
+			if (!--j->active) {
+				m_done.notify_all();
+			}
+		}
+	}
+
+	mutex m_lock;
+	condition_variable m_work;
+	condition_variable m_done;
+	deque<job*> m_jobs;
+	vector<thread> m_threads;
+	bool m_stop = false;
+};
+}
+
+unsigned default_jobs()
+{
+	return max(jobs_override ? jobs_override : thread::hardware_concurrency(), 1u);
+}
+
+void default_jobs(unsigned jobs)
+{
+	jobs_override = jobs;
+}
+
+void parallel_for(size_t count, unsigned jobs, const function<void(size_t)>& func)
+{
+	// captured messages would otherwise be logged by other threads
+	jobs = min<size_t>(logger::capture::active() ? 1 : max(jobs, 1u), count);
+
+	if (jobs < 2) {
+		for (size_t i = 0; i < count; ++i) {
+			func(i);
+		}
+
+		return;
+	}
+
+	thread_pool::job j;
+	j.func = &func;
+	j.count = count;
+	j.helpers = jobs - 1;
+
+	thread_pool::instance().run(j);
+
+	if (j.error) {
+		rethrow_exception(j.error);
+	}
+}
+
+size_t parallel_find_first(size_t count, unsigned jobs, const function<bool(size_t)>& pred)
+{
+	atomic<size_t> found(count);
+
+	parallel_for(count, jobs, [&] (size_t i) {
+		if (i < found && pred(i)) {
+			size_t prev = found;
+			while (i < prev && !found.compare_exchange_weak(prev, i)) {
+				// retry
+			}
+		}
+	});
+
+	return found;
+}
+
 int logger::s_loglevel = logger::info;
 bool logger::s_no_stdout = false;
+bool logger::s_logfile = false;
+thread_local ostream* logger::s_capture = nullptr;
 list<string> logger::s_lines;
 
 constexpr int logger::trace;
@@ -241,7 +481,11 @@ constexpr int logger::err;
 
 ostream& logger::log(int severity)
 {
-	if (severity < s_loglevel) {
+	if (s_capture) {
+		// discards everything
+		static thread_local ostream null(nullptr);
+		return severity < s_loglevel ? null : *s_capture;
+	} else if (severity < s_loglevel) {
 		return logbuf::file;
 	} else if (s_no_stdout || severity >= warn) {
 		return log_cerr;
@@ -277,6 +521,7 @@ void logger::log_io(const string& line, bool in)
 void logger::set_logfile(const string& filename)
 {
 	logbuf::file.open(filename.c_str());
+	s_logfile = logbuf::file.is_open();
 }
 
 string getaddrinfo_category::message(int condition) const
@@ -20,6 +20,7 @@
 #ifndef BCM2UTILS_UTIL_H
 #define BCM2UTILS_UTIL_H
 #include <type_traits>
+#include <algorithm>
 #include <system_error>
 #include <functional>
 #include <stdexcept>
@@ -29,6 +30,7 @@
 #include <fstream>
 #include <sstream>
 #include <cstdarg>
+#include <cstring>
 #include <chrono>
 #include <memory>
 #include <cerrno>
@@ -118,7 +120,13 @@ template<class T> std::string to_buf(const T& t)
 
 template<class T> T extract(const std::string& data, std::string::size_type offset = 0)
 {
-	return *reinterpret_cast<const T*>(data.substr(offset, sizeof(data)).c_str());
+	if (offset > data.size()) {
+		throw std::out_of_range("offset " + std::to_string(offset) + " exceeds buffer size");
+	}
+
+	T t = T();
+	std::memcpy(&t, data.data() + offset, std::min(sizeof(T), data.size() - offset));
+	return t;
 }
 
 template<class T> void patch(std::string& data, std::string::size_type offset, const T& t)
@@ -134,7 +142,7 @@ class bad_lexical_cast : public std::invalid_argument
 
 template<class T> T lexical_cast(const std::string& str, unsigned base = 10, bool all = true)
 {
-	static std::istringstream istr;
+	static thread_local std::istringstream istr;
 	istr.clear();
 	istr.str(str);
 	T t;
@@ -242,6 +250,29 @@ class mstimer
 
 std::string transform(const std::string& str, std::function<int(int)> f);
 
+// writes data to a temporary file, which then replaces `filename`, so that
+// readers never see a partially written file. on failure, returns false
+// and leaves errno set.
+bool write_file_atomic(const std::string& filename, const std::string& data);
+
+// number of threads to use if not specified otherwise (at least 1). unless
+// set explicitly, this is the number of CPUs.
+unsigned default_jobs();
+void default_jobs(unsigned jobs);
+
+// calls func(i) for every i in [0, count), using the calling thread and up
+// to `jobs - 1` threads from a pool shared by all callers. the first
+// exception thrown by func is rethrown once all threads have finished;
+// remaining calls are skipped in that case. nested calls (i.e. from within
+// func) are fine, but calls made while logger output is captured run on
+// the calling thread only.
+void parallel_for(size_t count, unsigned jobs, const std::function<void(size_t)>& func);
+
+// returns the lowest i in [0, count) for which pred(i) returns true, or
+// `count` if there is none. pred is called in parallel (see parallel_for),
+// but no longer called for indices above the lowest match found so far.
+size_t parallel_find_first(size_t count, unsigned jobs, const std::function<bool(size_t)>& pred);
+
 template<class T> T ntoh(const T& n);
 template<class T> T hton(const T& n);
 
@@ -310,6 +341,51 @@ class cleaner
 	std::function<void()> m_cleanup;
 };
 
+// read-only stream for data that is already in memory. the data is
+// not copied, and must thus outlive the stream.
+class imemstream : public std::istream
+{
+	class membuf : public std::streambuf
+	{
+		public:
+		membuf(const char* data, size_t size)
+		{
+			auto p = const_cast<char*>(data);
+			setg(p, p, p + size);
+		}
+
+		protected:
+		virtual pos_type seekoff(off_type off, std::ios::seekdir dir, std::ios::openmode which) override
+		{
+			if (which & std::ios::out) {
+				return pos_type(off_type(-1));
+			}
+
+			char* p = dir == std::ios::beg ? eback() : (dir == std::ios::cur ? gptr() : egptr());
+			if (off < (eback() - p) || off > (egptr() - p)) {
+				return pos_type(off_type(-1));
+			}
+
+			setg(eback(), p + off, egptr());
+			return pos_type(gptr() - eback());
+		}
+
+		virtual pos_type seekpos(pos_type pos, std::ios::openmode which) override
+		{ return seekoff(off_type(pos), std::ios::beg, which); }
+	};
+
+	public:
+	imemstream(const char* data, size_t size)
+	: std::istream(nullptr), m_buf(data, size)
+	{ rdbuf(&m_buf); }
+
+	explicit imemstream(const std::string& buf)
+	: imemstream(buf.data(), buf.size()) {}
+
+	private:
+	membuf m_buf;
+};
+
 #define BCM2UTILS_LOGF_BODY(severity, format) \
 		va_list args; \
 		va_start(args, format); \
@@ -322,6 +398,16 @@ class cleaner
 			BCM2UTILS_LOGF_BODY(severity, format); \
 		}
 
+// like logger::t() etc., but the remainder of the statement (i.e. all arguments to
+// operator<<) is only evaluated if the message is actually written somewhere.
+#define BCM2UTILS_LOG(severity) \
+		if (!bcm2dump::logger::enabled(bcm2dump::logger::severity)) {} \
+		else bcm2dump::logger::log(bcm2dump::logger::severity)
+
+#define LOG_T() BCM2UTILS_LOG(trace)
+#define LOG_D() BCM2UTILS_LOG(debug)
+#define LOG_V() BCM2UTILS_LOG(verbose)
+
 class logger
 {
 	public:
@@ -332,6 +418,25 @@ class logger
 	static constexpr int warn = 4;
 	static constexpr int err = 5;
 
+	// while an instance exists, messages logged by the creating thread are
+	// written to the given stream instead (if they're above the log level)
+	class capture
+	{
+		public:
+		capture(std::ostream& os) : m_prev(s_capture)
+		{ s_capture = &os; }
+
+		~capture()
+		{ s_capture = m_prev; }
+
+		// returns true if the calling thread's messages are being captured
+		static bool active()
+		{ return s_capture; }
+
+		private:
+		std::ostream* m_prev;
+	};
+
 	static std::ostream& log(int severity);
 
 	static void log(int severity, const char* format, va_list args);
@@ -366,6 +471,10 @@ class logger
 	static int loglevel()
 	{ return s_loglevel; }
 
+	// messages below the current log level are still written to the log file
+	static bool enabled(int severity)
+	{ return severity >= s_loglevel || (s_logfile && !s_capture); }
+
 	static void no_stdout(bool no_stdout = true)
 	{ s_no_stdout = no_stdout; }
 
@@ -378,6 +487,8 @@ class logger
 	static std::list<std::string> s_lines;
 	static int s_loglevel;
 	static bool s_no_stdout;
+	static bool s_logfile;
+	static thread_local std::ostream* s_capture;
 };
 
 class user_error : public std::runtime_error